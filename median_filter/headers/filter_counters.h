@@ -0,0 +1,82 @@
+/*!
+ * \file filter_counters.h
+ *
+ * \brief Define optional hot path counters for the median filter.
+ *
+ * \details Counters are only compiled in when MEDFILTER_COUNTERS is defined (see make COUNTERS=1). Without it,
+ *          every macro below expands to nothing, so production builds carry no instrumentation cost. Counters
+ *          are accumulated once per filter call rather than per pixel and are safe to update from several
+ *          threads.
+ */
+
+#ifndef _FILTER_COUNTERS_H_
+#define _FILTER_COUNTERS_H_
+
+#include <time.h>
+#include <stdint.h>
+
+/*!
+ * \brief Process wide filter counters.
+ */
+struct filter_counters_t
+{
+    uint64_t filter_calls; /*!< Number of filter passes run. */
+    uint64_t network_pixels; /*!< Pixels whose median came from a sorting network. */
+    uint64_t sort_pixels; /*!< Pixels whose median came from qsort(). */
+    uint64_t samples; /*!< Window samples gathered across all filtered pixels. */
+    uint64_t decode_ns; /*!< Time spent decoding server requests. */
+    uint64_t filter_ns; /*!< Time spent filtering server requests. */
+    uint64_t encode_ns; /*!< Time spent encoding server responses. */
+};
+
+#ifdef MEDFILTER_COUNTERS
+
+extern struct filter_counters_t filter_counters; /*!< Counters shared by all threads. */
+
+/*!
+ * \brief Start counting CPU cycles and last level cache misses on the calling thread.
+ * \details Uses the Linux perf_event_open() interface. If hardware counters are not available (e.g., due to
+ *          perf_event_paranoid or a virtualized PMU), the reason is recorded and printed by
+ *          print_filter_counters() instead.
+ */
+void perf_counters_begin(void);
+
+/*!
+ * \brief Stop the hardware counters started by perf_counters_begin() and record their values.
+ */
+void perf_counters_end(void);
+
+/*!
+ * \brief Print all counters to stdout.
+ */
+void print_filter_counters(void);
+
+/*!
+ * \brief Read the monotonic clock in nanoseconds.
+ */
+static inline uint64_t filter_counters_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+#define FILTER_COUNTER_ADD(name, n) __atomic_fetch_add(&filter_counters.name, (n), __ATOMIC_RELAXED)
+#define FILTER_STAGE_BEGIN(start) const uint64_t start = filter_counters_now_ns()
+#define FILTER_STAGE_END(name, start) FILTER_COUNTER_ADD(name, filter_counters_now_ns() - (start))
+#define FILTER_PERF_BEGIN() perf_counters_begin()
+#define FILTER_PERF_END() perf_counters_end()
+#define FILTER_COUNTERS_PRINT() print_filter_counters()
+
+#else
+
+#define FILTER_COUNTER_ADD(name, n) do { } while (0)
+#define FILTER_STAGE_BEGIN(start) do { } while (0)
+#define FILTER_STAGE_END(name, start) do { } while (0)
+#define FILTER_PERF_BEGIN() do { } while (0)
+#define FILTER_PERF_END() do { } while (0)
+#define FILTER_COUNTERS_PRINT() do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+/*!
+ * \file filter_server.h
+ *
+ * \brief Define a long-running median filter service listening on a Unix domain socket.
+ *
+ * \details The filter server exists for clients that filter many small images. Running medfilter as a
+ *          subprocess per image pays for process startup and buffer allocation on every call. The server
+ *          instead keeps a fixed pool of worker threads alive, each owning a set of image and encode buffers
+ *          that are recycled from one request to the next.
+ *
+ *          Clients connect to the socket and send one or more requests over the same connection. All
+ *          integers on the wire are unsigned 32-bit values in network byte order.
+ *
+ *          Request:  magic | dim | algorithm | length | length bytes of JPG data
+ *          Response: status | length | length bytes of filtered JPG data
+ *
+ *          A response with a non-zero status carries no payload. The server closes the connection after
+ *          replying to a malformed request, and closes connections that send nothing for
+ *          FILTER_SERVER_IDLE_TIMEOUT_S seconds so that idle clients cannot tie up the workers.
+ */
+
+#ifndef _FILTER_SERVER_H_
+#define _FILTER_SERVER_H_
+
+#include <stdint.h>
+
+#define FILTER_SERVER_MAGIC 0x4D464C54 /*!< Request header magic ("MFLT"). */
+#define FILTER_SERVER_MAX_PAYLOAD (64 * 1024 * 1024) /*!< Largest accepted request image in bytes. */
+#define FILTER_SERVER_IDLE_TIMEOUT_S 30 /*!< Seconds a connection may go without sending before it is closed. */
+
+/*!
+ * \brief Median filter algorithms a client may request.
+ */
+enum filter_algorithm_t
+{
+    FILTER_ALGO_BRUTE_FORCE = 0, /*!< Square dim x dim window. */
+    FILTER_ALGO_CROSS = 1, /*!< Plus shaped window spanning the center row and column of a dim x dim square. */
+};
+
+/*!
+ * \brief Status codes returned in the response header.
+ */
+enum filter_status_t
+{
+    FILTER_STATUS_OK = 0, /*!< Request succeeded. The payload holds the filtered image. */
+    FILTER_STATUS_BAD_REQUEST = 1, /*!< Bad magic, dimension, algorithm, or payload length. */
+    FILTER_STATUS_DECODE_ERROR = 2, /*!< The request payload is not a readable JPG image. */
+    FILTER_STATUS_FILTER_ERROR = 3, /*!< The median filter failed. */
+    FILTER_STATUS_ENCODE_ERROR = 4, /*!< The filtered image could not be encoded. */
+};
+
+/*!
+ * \brief Filter server settings.
+ */
+struct filter_server_config_t
+{
+    const char* socket_path; /*!< Filesystem path of the Unix domain socket to listen on. */
+    uint32_t nthreads; /*!< Number of worker threads (and thus concurrent connections) to serve. */
+    uint32_t quality; /*!< Output image quality in the range [0,100]. */
+    int print_stats; /*!< If TRUE, print request latency percentiles on exit and on SIGUSR1. */
+};
+
+/*!
+ * \brief Run the filter server until the process receives SIGINT or SIGTERM.
+ * \details run_filter_server() binds \p config->socket_path, replacing any stale socket file, and spawns
+ *          \p config->nthreads workers that accept connections directly from the listening socket. The
+ *          calling thread waits for signals. SIGUSR1 prints latency statistics without stopping the server.
+ * \param config Server settings.
+ * \return 0 if the server ran and shut down cleanly, 1 otherwise.
+ */
+int run_filter_server(const struct filter_server_config_t* config);
+
+#endif
@@ -21,6 +21,32 @@ struct grayscale_image_t
     uint32_t width; /*!< Width of the image. */
     uint32_t height; /*!< Height of the image. */
     JSAMPROW* pixelmat; /*!< grayscale value matrix with dimension \p width by \p height.*/
+    uint32_t row_capacity; /*!< Number of rows allocated in \p pixelmat. */
+    uint32_t col_capacity; /*!< Number of samples allocated in each row of \p pixelmat. */
+};
+
+/*!
+ * \brief Axis aligned rectangle within an image.
+ */
+struct image_roi_t
+{
+    uint32_t x; /*!< Column of the top left corner. */
+    uint32_t y; /*!< Row of the top left corner. */
+    uint32_t width; /*!< Number of columns. */
+    uint32_t height; /*!< Number of rows. */
+};
+
+/*!
+ * \brief Growable byte buffer holding an encoded JPG image.
+ * \details jpeg_buffer_t objects are meant to be reused across calls to write_jpeg_mem() so that
+ *          encoding a stream of images does not allocate once the buffer has grown to fit the
+ *          largest image seen.
+ */
+struct jpeg_buffer_t
+{
+    unsigned char* data; /*!< Encoded image bytes. */
+    unsigned long size; /*!< Number of valid bytes in \p data. */
+    unsigned long capacity; /*!< Number of bytes allocated to \p data. */
 };
 
 /*!
@@ -38,6 +64,18 @@ int alloc_image(struct grayscale_image_t* img, uint32_t w, uint32_t h);
  */
 void free_image(struct grayscale_image_t* img);
 
+/*!
+ * \brief Resize \p img to \p w by \p h, reusing its current allocation when large enough.
+ * \details reserve_image() only allocates when \p img has never been allocated or when its capacity is
+ *          smaller than the requested dimensions. In either case, the first \p h rows of \p img are
+ *          zeroed on return.
+ * \param img Grayscale image structure. Must be zero initialized or previously allocated.
+ * \param w Width of the image.
+ * \param h Height of the image.
+ * \return 0 if \p img can hold a \p w by \p h image, 1 otherwise.
+ */
+int reserve_image(struct grayscale_image_t* img, uint32_t w, uint32_t h);
+
 /*!
  * \brief Load the image data stored in \p filename to \p img.
  * \details read_jpeg() uses the libjpeg API to read image data from the file pointed to by \p filename.
@@ -51,6 +89,22 @@ void free_image(struct grayscale_image_t* img);
  */
 int read_jpeg(const char* filename, struct grayscale_image_t* img);
 
+/*!
+ * \brief Load only the \p region rectangle of the image stored in \p filename to \p img.
+ * \details read_jpeg_region() clips \p region to the image bounds. When libjpeg supports partial decoding
+ *          (libjpeg-turbo 1.5 and up), rows above \p region are skipped with jpeg_skip_scanlines(), columns
+ *          outside of it are cropped with jpeg_crop_scanline(), and decoding stops after the last row of
+ *          \p region. Otherwise the whole image is decoded but only \p region is kept. Either way, \p img
+ *          is only ever as large as the decoded rectangle.
+ * \param filename Path to a grayscale JPG file.
+ * \param img grayscale_image_t structure used to store the image data extracted from \p filename.
+ * \param region On input, the rectangle to load. On output, the rectangle actually stored in \p img. The
+ *        stored rectangle always covers the clipped request but may start further left and be wider
+ *        since libjpeg crops at iMCU boundaries.
+ * \return 0 if image data from \p filename is read into \p img, 1 otherwise.
+ */
+int read_jpeg_region(const char* filename, struct grayscale_image_t* img, struct image_roi_t* region);
+
 /*!
  * \brief Write image data in \p img to \p filename with caller specified quality.
  * \param filename Name of the file to which image data will be written.
@@ -60,4 +114,34 @@ int read_jpeg(const char* filename, struct grayscale_image_t* img);
  */
 int write_jpeg(const char* filename, const struct grayscale_image_t* img, uint32_t quality);
 
+/*!
+ * \brief Decode the JPG image stored in the \p size bytes at \p buf into \p img.
+ * \details Unlike read_jpeg(), read_jpeg_mem() recovers from libjpeg errors (e.g., a truncated or
+ *          corrupt image) by returning an error code instead of exiting the process. \p img is
+ *          filled via reserve_image() so a previously allocated image is reused when it is large enough.
+ * \param buf Encoded JPG image.
+ * \param size Number of bytes in \p buf.
+ * \param img grayscale_image_t structure used to store the decoded image data.
+ * \return 0 if the image data in \p buf is decoded into \p img, 1 otherwise.
+ */
+int read_jpeg_mem(const unsigned char* buf, unsigned long size, struct grayscale_image_t* img);
+
+/*!
+ * \brief Encode the image data in \p img into \p out with caller specified quality.
+ * \details The encoded bytes overwrite the contents of \p out. \p out is grown as needed and keeps its
+ *          allocation between calls. Like read_jpeg_mem(), libjpeg errors are reported via the return code.
+ *          On failure \p out still owns everything it grew to and is released by free_jpeg_buffer() as usual.
+ * \param out Encoded image buffer. Must be zero initialized or previously used with write_jpeg_mem().
+ * \param img Grayscale JPG image data.
+ * \param quality Integer value in the range [0,100] indicating output image quality.
+ * \return 0 if \p img is encoded into \p out successfully, 1 otherwise.
+ */
+int write_jpeg_mem(struct jpeg_buffer_t* out, const struct grayscale_image_t* img, uint32_t quality);
+
+/*!
+ * \brief Free memory previously allocated to \p buf by write_jpeg_mem().
+ * \param buf A jpeg_buffer_t previously passed to write_jpeg_mem().
+ */
+void free_jpeg_buffer(struct jpeg_buffer_t* buf);
+
 #endif
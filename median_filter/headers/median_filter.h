@@ -13,7 +13,8 @@
 /*!
  * \brief Execute a NxN median filter on the \p src image and store the result in the \p dst image.
  * \details compute_median_filter() implements a bruteforce NxN median filter. This filter does not
- *          address the boundaries of the \p src image.
+ *          address the boundaries of the \p src image. \p dst is sized via reserve_image() so passing
+ *          the same \p dst across calls reuses its memory.
  * \param dst A grayscale JPG image.
  * \param src A grayscale JPG image passed through an NxN median filter.
  * \param dim The dimension of NxN median grid.
@@ -21,4 +22,93 @@
  */
 int compute_median_filter(struct grayscale_image_t* dst, const struct grayscale_image_t* src, uint32_t dim);
 
+/*!
+ * \brief Shape of a median filter window.
+ * \details A kernel lists the samples that make up the window around each pixel as offsets from the
+ *          pixel. Weighted positions appear in the list once per unit of weight so the median of the
+ *          gathered samples is the weighted median. Kernels that sample fewer pixels than a full square
+ *          are proportionally cheaper to apply.
+ */
+struct filter_kernel_t
+{
+    uint32_t dim; /*!< Width and height of the square bounding the kernel. */
+    uint32_t nsamples; /*!< Number of samples gathered per pixel, counting weighted positions repeatedly. */
+    int32_t* row_offsets; /*!< Row offset of each sample relative to the filtered pixel. */
+    int32_t* col_offsets; /*!< Column offset of each sample relative to the filtered pixel. */
+};
+
+/*!
+ * \brief Build a \p dim by \p dim square kernel whose center sample counts \p center_weight times.
+ * \details A \p center_weight of 1 yields the plain NxN median. Larger weights make the center-weighted
+ *          median, which preserves more fine detail.
+ * \param kernel Kernel to populate. Release with free_kernel().
+ * \param dim The dimension of NxN median grid.
+ * \param center_weight Number of times the center pixel is counted.
+ * \return 0 if \p kernel was built, 1 otherwise.
+ */
+int make_square_kernel(struct filter_kernel_t* kernel, uint32_t dim, uint32_t center_weight);
+
+/*!
+ * \brief Build a plus shaped kernel spanning the center row and column of a \p dim by \p dim square.
+ * \details Cross kernels touch 2 * \p dim - 1 samples instead of \p dim squared and are well suited to
+ *          line artifacts that only extend along one axis.
+ * \param kernel Kernel to populate. Release with free_kernel().
+ * \param dim The dimension of the bounding square.
+ * \param center_weight Number of times the center pixel is counted.
+ * \return 0 if \p kernel was built, 1 otherwise.
+ */
+int make_cross_kernel(struct filter_kernel_t* kernel, uint32_t dim, uint32_t center_weight);
+
+/*!
+ * \brief Build a kernel from a bitmap such as "010/111/010".
+ * \details \p mask lists the rows of a square of odd dimension separated by '/'. Each character is a
+ *          decimal digit giving the weight of that position, so 0 excludes a pixel, 1 includes it, and larger
+ *          digits count it several times.
+ * \param kernel Kernel to populate. Release with free_kernel().
+ * \param mask Kernel bitmap.
+ * \return 0 if \p mask is well formed and \p kernel was built, 1 otherwise.
+ */
+int parse_kernel_mask(struct filter_kernel_t* kernel, const char* mask);
+
+/*!
+ * \brief Free memory previously allocated to \p kernel.
+ * \param kernel A kernel built by one of the make functions above.
+ */
+void free_kernel(struct filter_kernel_t* kernel);
+
+/*!
+ * \brief Execute a median filter with window \p kernel on the \p roi rectangle of \p src and store the result in \p dst.
+ * \details Only pixels inside \p roi are filtered. Pixels of \p src outside of \p roi are read as part of
+ *          the filter window but are otherwise ignored. \p dst is resized to the dimensions of \p roi. As with
+ *          compute_median_filter(), pixels within dim/2 of the \p src border are left unfiltered. Kernels of
+ *          up to 9 samples as well as 25 sample kernels (e.g., 5x5) use a fixed sorting network instead of a sort.
+ * \param dst A grayscale JPG image holding the filtered \p roi.
+ * \param src A grayscale JPG image.
+ * \param kernel The filter window.
+ * \param roi Rectangle of \p src to filter. Must lie within \p src.
+ * \return 0 if the median filter was computed and the result stored in \p dst, 1 otherwise.
+ */
+int compute_median_filter_roi(struct grayscale_image_t* dst, const struct grayscale_image_t* src,
+        const struct filter_kernel_t* kernel, const struct image_roi_t* roi);
+
+/*!
+ * \brief Apply up to \p passes median filters back to back and store the \p roi rectangle of the result in \p dst.
+ * \details Each pass filters the output of the previous one, exactly as if medfilter were run repeatedly on
+ *          its own output but without decoding and encoding in between. Passes alternate between \p src
+ *          and a single scratch image so only one extra frame is allocated no matter how many passes run.
+ *          Filtering stops early once a pass changes fewer than \p min_changes pixels inside \p roi.
+ * \param dst A grayscale JPG image holding the filtered \p roi.
+ * \param src A grayscale JPG image. Its contents are overwritten by intermediate passes.
+ * \param kernel The filter window.
+ * \param roi Rectangle of \p src kept in \p dst. Must lie within \p src. Pixels within passes * dim/2 of
+ *        the border of \p src are only exact if that border is also the image border.
+ * \param passes Maximum number of filter passes. Must be positive.
+ * \param min_changes Stop once a pass changes fewer than this many pixels of \p roi. Zero disables early stopping.
+ * \param passes_run If not NULL, set to the number of passes actually applied.
+ * \return 0 if the median filter was computed and the result stored in \p dst, 1 otherwise.
+ */
+int compute_median_filter_passes(struct grayscale_image_t* dst, struct grayscale_image_t* src,
+        const struct filter_kernel_t* kernel, const struct image_roi_t* roi, uint32_t passes, uint32_t min_changes,
+        uint32_t* passes_run);
+
 #endif
@@ -10,10 +10,13 @@
 #include <time.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "jpeg_helpers.h"
 #include "median_filter.h"
+#include "filter_server.h"
+#include "filter_counters.h"
 
 #define DEFAULT_DIM 5
 #define DEFAULT_IMAGE_QUALITY 95
@@ -21,22 +24,77 @@
 static void print_usage()
 {
     printf("Usage: medfilter [OPTIONS] in_image out_image\n");
+    printf("       medfilter [OPTIONS] -S socket_path\n");
     printf("Run an NxN median filter on a grayscale JPG.\n");
     printf("\t-d\tDimension of the filter (i.e., the N in NxN).\n");
     printf("\t-s\tPrint timing statistics.\n");
+    printf("\t-k\tFilter window shape: square (default), cross, or a digit mask such as 010/111/010.\n");
+    printf("\t-w\tWeight (at least 1) of the center pixel for square and cross windows.\n");
+    printf("\t-n\tNumber of filter passes to apply before writing the output image.\n");
+    printf("\t-e\tStop filtering once a pass changes fewer than this many pixels.\n");
+    printf("\t-r\tOnly decode and filter the region x,y,w,h. The output image is w by h.\n");
+    printf("\t-S\tServe filter requests on a Unix domain socket instead of filtering a file.\n");
+    printf("\t-t\tNumber of server worker threads (defaults to the number of online CPUs).\n");
     printf("\t-h\tPrint this help page.\n");
 }
 
+/*!
+ * \brief Load the part of \p filename needed to filter \p roi.
+ * \details The region decoded is \p roi grown by \p halo pixels on every side. With a halo of passes * dim/2,
+ *          pixels along the edges of \p roi see the same windows on every pass as they would in the full image.
+ * \param filename Path to a grayscale JPG file.
+ * \param img Image receiving the decoded region.
+ * \param roi On input, the region of interest in image coordinates. On output, the region of interest
+ *        relative to \p img clipped to the image bounds.
+ * \param halo Number of pixels around \p roi the filter reads.
+ * \return 0 if the region is loaded into \p img, 1 otherwise.
+ */
+static int load_roi(const char* filename, struct grayscale_image_t* img, struct image_roi_t* roi, uint32_t halo)
+{
+    struct image_roi_t region;
+
+    region.x = (roi->x > halo) ? roi->x - halo : 0;
+    region.y = (roi->y > halo) ? roi->y - halo : 0;
+    region.width = roi->x + roi->width + halo - region.x;
+    region.height = roi->y + roi->height + halo - region.y;
+    if (read_jpeg_region(filename, img, &region))
+        return 1;
+
+    if ((roi->x >= region.x + region.width) || (roi->y >= region.y + region.height)) {
+        fprintf(stderr, "region of interest lies outside of %s\n", filename);
+        return 1;
+    }
+    roi->x -= region.x;
+    roi->y -= region.y;
+    if (roi->width > img->width - roi->x)
+        roi->width = img->width - roi->x;
+    if (roi->height > img->height - roi->y)
+        roi->height = img->height - roi->y;
+
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     int c = 0;
     int dim = DEFAULT_DIM;
     int print_stats = FALSE;
+    const char* kernel_shape = "square";
+    int center_weight = 1;
+    int weight_given = FALSE;
+    struct filter_kernel_t kernel;
+    uint32_t passes = 1;
+    uint32_t passes_run = 0;
+    uint32_t min_changes = 0;
+    int use_roi = FALSE;
+    struct image_roi_t roi = {0, 0, 0, 0};
+    const char* socket_path = NULL;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
     clock_t start, end;
     double read_time, write_time, filter_time = 0.0;
 
     opterr = 0;
-    while (-1 != (c = getopt(argc, argv, "hsd:t:"))) {
+    while (-1 != (c = getopt(argc, argv, "hsd:k:w:n:e:r:t:S:"))) {
         switch (c) {
             case 'h':
                 print_usage();
@@ -52,6 +110,49 @@ int main(int argc, char** argv)
             case 's':
                 print_stats = TRUE;
                 break;
+            case 'k':
+                kernel_shape = optarg;
+                break;
+            case 'w':
+                center_weight = atoi(optarg);
+                weight_given = TRUE;
+                if (center_weight < 1) {
+                    fprintf(stderr, "illegal center weight: %d\n", center_weight);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "illegal number of passes: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                passes = atoi(optarg);
+                break;
+            case 'e':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "illegal early stop threshold: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                min_changes = atoi(optarg);
+                break;
+            case 'r':
+                if ((4 != sscanf(optarg, "%u,%u,%u,%u", &roi.x, &roi.y, &roi.width, &roi.height)) ||
+                        (0 == roi.width) || (0 == roi.height)) {
+                    fprintf(stderr, "illegal region: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                use_roi = TRUE;
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 't':
+                nthreads = atol(optarg);
+                if (nthreads <= 0) {
+                    fprintf(stderr, "illegal thread count: %ld\n", nthreads);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?':
                 if ('c' == optopt)
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
@@ -65,19 +166,48 @@ int main(int argc, char** argv)
         }
     }
 
+    if (socket_path) {
+        struct filter_server_config_t config = {
+            socket_path, (nthreads > 0) ? (uint32_t)nthreads : 1, DEFAULT_IMAGE_QUALITY, print_stats
+        };
+        return run_filter_server(&config) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     if ((NULL == argv[optind]) || (NULL == argv[optind+1])) {
         fprintf(stderr, "missing input image and/or output image file name(s)\n");
         fprintf(stderr, "see program usage using the -h options for help\n");
         exit(EXIT_FAILURE);
     }
 
+    // Build the filter window.
+    int kernel_error = 0;
+    if (0 == strcmp(kernel_shape, "square"))
+        kernel_error = make_square_kernel(&kernel, dim, center_weight);
+    else if (0 == strcmp(kernel_shape, "cross"))
+        kernel_error = make_cross_kernel(&kernel, dim, center_weight);
+    else if (weight_given) {
+        // The digits of a mask already give the weight of every position, the center included.
+        fprintf(stderr, "-w cannot be combined with a kernel mask; weight the mask's center digit instead\n");
+        exit(EXIT_FAILURE);
+    } else
+        kernel_error = parse_kernel_mask(&kernel, kernel_shape);
+    if (kernel_error) {
+        fprintf(stderr, "unable to build %s filter window\n", kernel_shape);
+        exit(EXIT_FAILURE);
+    }
+    dim = kernel.dim;
+
     // Read in the input image.
     struct grayscale_image_t src_img = {0, 0, NULL};
     start = clock();
-    if (read_jpeg(argv[optind], &src_img)) {
+    if (use_roi ? load_roi(argv[optind], &src_img, &roi, passes * (dim / 2)) : read_jpeg(argv[optind], &src_img)) {
         fprintf(stderr, "unable to load JPG file contents: %s\n", argv[optind]);
         exit(EXIT_FAILURE);
     }
+    if (!use_roi) {
+        roi.width = src_img.width;
+        roi.height = src_img.height;
+    }
     end = clock();
     printf("Image file %s (%dx%d) loaded successfully.\n", argv[optind], src_img.width, src_img.height);
     read_time = (((double) (end - start)) / CLOCKS_PER_SEC) * 1000.0;
@@ -85,11 +215,13 @@ int main(int argc, char** argv)
     // Compute the NxN median filter of the input image.
     struct grayscale_image_t dst_img = {0, 0, NULL};
     start = clock();
-    if (compute_median_filter(&dst_img, &src_img, dim)) {
+    FILTER_PERF_BEGIN();
+    if (compute_median_filter_passes(&dst_img, &src_img, &kernel, &roi, passes, min_changes, &passes_run)) {
         fprintf(stderr, "unable to compute filter\n");
         free_image(&src_img);
         free_image(&dst_img);
     }
+    FILTER_PERF_END();
     end = clock();
     printf("%dx%d median filter applied to %s. Result image will be written to %s.\n",
             dim, dim, argv[optind], argv[optind+1]);
@@ -107,12 +239,15 @@ int main(int argc, char** argv)
 
     free_image(&src_img);
     free_image(&dst_img);
+    free_kernel(&kernel);
 
     if (print_stats) {
         printf("-----------%dx%d Filter Statistics (START)-----------\n", dim, dim);
         printf("Read Time = %.2lf ms.\n", read_time);
         printf("Write Time = %.2lf ms.\n", write_time);
         printf("Filter Time = %.2lf ms.\n", filter_time);
+        printf("Filter Passes = %u of %u.\n", passes_run, passes);
+        FILTER_COUNTERS_PRINT();
         printf("-----------%dx%d Filter Statistics (END)-------------\n", dim, dim);
     }
 
@@ -0,0 +1,124 @@
+/*!
+ * \file filter_counters.c
+ *
+ * \brief filter_counters.h implementation file.
+ */
+
+#include "filter_counters.h"
+
+#ifdef MEDFILTER_COUNTERS
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+struct filter_counters_t filter_counters;
+
+/*!
+ * \brief Hardware counter state for the filter stage.
+ */
+struct perf_state_t
+{
+    int cycles_fd; /*!< Group leader counting CPU cycles. */
+    int misses_fd; /*!< Last level cache misses. */
+    int valid; /*!< TRUE once a begin/end pair recorded values. */
+    uint64_t cycles; /*!< CPU cycles spent between begin and end. */
+    uint64_t llc_misses; /*!< Cache misses between begin and end. */
+    char error[128]; /*!< Why the counters are unavailable, if they are. */
+};
+
+static struct perf_state_t perf = {-1, -1, 0, 0, 0, ""};
+
+#ifdef __linux__
+static int open_perf_event(uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = (-1 == group_fd); // Members follow the leader.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+static void close_perf_events(void)
+{
+    if (perf.misses_fd >= 0)
+        close(perf.misses_fd);
+    if (perf.cycles_fd >= 0)
+        close(perf.cycles_fd);
+    perf.cycles_fd = -1;
+    perf.misses_fd = -1;
+}
+
+void perf_counters_begin(void)
+{
+#ifdef __linux__
+    perf.valid = 0;
+    perf.cycles_fd = open_perf_event(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (perf.cycles_fd >= 0)
+        perf.misses_fd = open_perf_event(PERF_COUNT_HW_CACHE_MISSES, perf.cycles_fd);
+    if ((perf.cycles_fd < 0) || (perf.misses_fd < 0)) {
+        snprintf(perf.error, sizeof(perf.error), "perf_event_open: %s", strerror(errno));
+        close_perf_events();
+        return;
+    }
+
+    ioctl(perf.cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf.cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    snprintf(perf.error, sizeof(perf.error), "perf_event_open is Linux only");
+#endif
+}
+
+void perf_counters_end(void)
+{
+#ifdef __linux__
+    if (perf.cycles_fd < 0)
+        return;
+
+    ioctl(perf.cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if ((sizeof(uint64_t) == read(perf.cycles_fd, &perf.cycles, sizeof(uint64_t))) &&
+            (sizeof(uint64_t) == read(perf.misses_fd, &perf.llc_misses, sizeof(uint64_t))))
+        perf.valid = 1;
+    else
+        snprintf(perf.error, sizeof(perf.error), "unable to read hardware counters: %s", strerror(errno));
+    close_perf_events();
+#endif
+}
+
+void print_filter_counters(void)
+{
+    const uint64_t PIXELS = filter_counters.network_pixels + filter_counters.sort_pixels;
+
+    printf("Filter Calls = %llu.\n", (unsigned long long)filter_counters.filter_calls);
+    printf("Network Pixels = %llu.\n", (unsigned long long)filter_counters.network_pixels);
+    printf("Sort Pixels = %llu.\n", (unsigned long long)filter_counters.sort_pixels);
+    printf("Window Samples = %llu (%.1lf per pixel).\n", (unsigned long long)filter_counters.samples,
+            (PIXELS) ? (double)filter_counters.samples / PIXELS : 0.0);
+    if (filter_counters.decode_ns || filter_counters.filter_ns || filter_counters.encode_ns) {
+        printf("Server Decode Time = %.2lf ms.\n", filter_counters.decode_ns / 1000000.0);
+        printf("Server Filter Time = %.2lf ms.\n", filter_counters.filter_ns / 1000000.0);
+        printf("Server Encode Time = %.2lf ms.\n", filter_counters.encode_ns / 1000000.0);
+    }
+    if (perf.valid) {
+        printf("Filter Cycles = %llu (%.1lf per pixel).\n", (unsigned long long)perf.cycles,
+                (PIXELS) ? (double)perf.cycles / PIXELS : 0.0);
+        printf("Filter LLC Misses = %llu.\n", (unsigned long long)perf.llc_misses);
+    } else if (perf.error[0]) {
+        printf("Hardware counters unavailable (%s).\n", perf.error);
+    }
+}
+
+#endif
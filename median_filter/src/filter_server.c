@@ -0,0 +1,465 @@
+/*!
+ * \file filter_server.c
+ *
+ * \brief filter_server.h implementation file.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "jpeg_helpers.h"
+#include "median_filter.h"
+#include "filter_server.h"
+#include "filter_counters.h"
+
+#define LATENCY_SAMPLES 65536 /*!< Number of most recent request latencies kept for percentiles. */
+#define FILTER_SERVER_MAX_DIM 255 /*!< Largest accepted filter dimension. */
+#define ACCEPT_BACKOFF_MS 100 /*!< Pause after an accept() error that retrying right away cannot clear. */
+
+/*!
+ * \brief Request latency bookkeeping shared by all workers.
+ */
+struct latency_stats_t
+{
+    pthread_mutex_t lock; /*!< Guards all other members. */
+    double samples[LATENCY_SAMPLES]; /*!< Ring buffer of request latencies in ms. */
+    uint64_t requests; /*!< Total number of requests served. */
+    uint64_t failures; /*!< Number of requests answered with a non-OK status. */
+    double max_ms; /*!< Largest latency ever recorded. */
+};
+
+struct filter_server_t;
+
+/*!
+ * \brief Per thread state. All buffers are recycled across requests.
+ */
+struct worker_t
+{
+    pthread_t tid; /*!< Worker thread handle. */
+    pthread_mutex_t lock; /*!< Guards \p conn_fd. */
+    int conn_fd; /*!< Connection currently being served or -1 if idle. */
+    unsigned char* req_buf; /*!< Request payload buffer. */
+    uint32_t req_capacity; /*!< Bytes allocated to \p req_buf. */
+    struct grayscale_image_t src; /*!< Decoded request image. */
+    struct grayscale_image_t dst; /*!< Filtered image. */
+    struct jpeg_buffer_t enc; /*!< Encoded response image. */
+    struct filter_kernel_t kernel; /*!< Filter window of the previous request. */
+    uint32_t kernel_algorithm; /*!< Algorithm \p kernel was built for. */
+    struct filter_server_t* server; /*!< Server owning this worker. */
+#ifdef MEDFILTER_COUNTERS
+    uint64_t busy_ns; /*!< Time spent serving requests. */
+#endif
+};
+
+/*!
+ * \brief Filter server state.
+ */
+struct filter_server_t
+{
+    const struct filter_server_config_t* config; /*!< Server settings. */
+    int listen_fd; /*!< Listening Unix domain socket. */
+    pthread_mutex_t lock; /*!< Guards \p stop. */
+    int stop; /*!< Set to TRUE when the server is shutting down. */
+    struct worker_t* workers; /*!< Worker pool with \p config->nthreads entries. */
+    uint32_t nstarted; /*!< Number of leading \p workers whose threads were started. */
+    struct latency_stats_t stats; /*!< Request latency statistics. */
+    struct timespec started; /*!< Time at which the server started. */
+};
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* end)
+{
+    return ((end->tv_sec - start->tv_sec) * 1000.0) + ((end->tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+static int doublecmp(const void* a, const void* b)
+{
+    const double ai = *(const double*)a;
+    const double bi = *(const double*)b;
+
+    if (ai == bi)
+        return 0;
+
+    return (ai < bi) ? -1 : 1;
+}
+
+static void record_latency(struct latency_stats_t* stats, double ms, int failed)
+{
+    pthread_mutex_lock(&stats->lock);
+    stats->samples[stats->requests % LATENCY_SAMPLES] = ms;
+    stats->requests++;
+    if (failed)
+        stats->failures++;
+    if (ms > stats->max_ms)
+        stats->max_ms = ms;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+static void print_latency_stats(struct latency_stats_t* stats)
+{
+    static const double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9};
+    static double sorted[LATENCY_SAMPLES];
+
+    pthread_mutex_lock(&stats->lock);
+    uint64_t requests = stats->requests;
+    uint64_t failures = stats->failures;
+    double max_ms = stats->max_ms;
+    size_t n = (requests < LATENCY_SAMPLES) ? requests : LATENCY_SAMPLES;
+    memcpy(sorted, stats->samples, n * sizeof(double));
+    pthread_mutex_unlock(&stats->lock);
+
+    qsort(sorted, n, sizeof(double), doublecmp);
+
+    printf("Requests = %llu (%llu failed).\n", (unsigned long long)requests, (unsigned long long)failures);
+    if (n) {
+        for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); ++i) {
+            size_t rank = (size_t)((PERCENTILES[i] / 100.0) * n);
+            if (rank >= n)
+                rank = n - 1;
+            printf("p%g Latency = %.2lf ms.\n", PERCENTILES[i], sorted[rank]);
+        }
+        printf("Max Latency = %.2lf ms.\n", max_ms);
+    }
+}
+
+static void print_server_stats(struct filter_server_t* server)
+{
+    printf("-----------Filter Server Statistics (START)-----------\n");
+    print_latency_stats(&server->stats);
+#ifdef MEDFILTER_COUNTERS
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double UPTIME_MS = elapsed_ms(&server->started, &now);
+    for (uint32_t i = 0; i < server->nstarted; ++i) {
+        const double BUSY_MS = __atomic_load_n(&server->workers[i].busy_ns, __ATOMIC_RELAXED) / 1000000.0;
+        printf("Worker %u Busy Time = %.2lf ms, Idle Time = %.2lf ms.\n", i, BUSY_MS, UPTIME_MS - BUSY_MS);
+    }
+#endif
+    FILTER_COUNTERS_PRINT();
+    printf("-----------Filter Server Statistics (END)-------------\n");
+    fflush(stdout);
+}
+
+static int read_full(int fd, void* buf, size_t len)
+{
+    unsigned char* p = (unsigned char*)buf;
+    while (len) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_response(int fd, uint32_t status, const unsigned char* payload, uint32_t len)
+{
+    uint32_t header[2] = {htonl(status), htonl(len)};
+    struct iovec iov[2] = {{header, sizeof(header)}, {(void*)payload, len}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len) ? 2 : 1;
+
+    while (msg.msg_iovlen) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return 1;
+
+        // Advance past whatever the kernel accepted.
+        while (msg.msg_iovlen && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen) {
+            msg.msg_iov->iov_base = (unsigned char*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static uint32_t filter_request(struct worker_t* w, uint32_t dim, uint32_t algorithm, uint32_t len)
+{
+    FILTER_STAGE_BEGIN(decode_start);
+    if (read_jpeg_mem(w->req_buf, len, &w->src))
+        return FILTER_STATUS_DECODE_ERROR;
+    FILTER_STAGE_END(decode_ns, decode_start);
+
+    if ((dim > w->src.width) || (dim > w->src.height))
+        return FILTER_STATUS_BAD_REQUEST;
+
+    // Clients tend to reuse the same settings so the window is only rebuilt when they change.
+    if ((dim != w->kernel.dim) || (algorithm != w->kernel_algorithm)) {
+        int kernel_error = 0;
+        free_kernel(&w->kernel);
+        switch (algorithm) {
+            case FILTER_ALGO_BRUTE_FORCE:
+                kernel_error = make_square_kernel(&w->kernel, dim, 1);
+                break;
+            case FILTER_ALGO_CROSS:
+                kernel_error = make_cross_kernel(&w->kernel, dim, 1);
+                break;
+            default:
+                return FILTER_STATUS_BAD_REQUEST;
+        }
+        if (kernel_error)
+            return FILTER_STATUS_FILTER_ERROR;
+        w->kernel_algorithm = algorithm;
+    }
+
+    FILTER_STAGE_BEGIN(filter_start);
+    struct image_roi_t frame = {0, 0, w->src.width, w->src.height};
+    if (compute_median_filter_roi(&w->dst, &w->src, &w->kernel, &frame))
+        return FILTER_STATUS_FILTER_ERROR;
+    FILTER_STAGE_END(filter_ns, filter_start);
+
+    FILTER_STAGE_BEGIN(encode_start);
+    if (write_jpeg_mem(&w->enc, &w->dst, w->server->config->quality))
+        return FILTER_STATUS_ENCODE_ERROR;
+    FILTER_STAGE_END(encode_ns, encode_start);
+
+    return FILTER_STATUS_OK;
+}
+
+static void serve_connection(struct worker_t* w, int fd)
+{
+    uint32_t header[4];
+    struct timespec start, end;
+
+    while (!read_full(fd, header, sizeof(header))) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        uint32_t magic = ntohl(header[0]);
+        uint32_t dim = ntohl(header[1]);
+        uint32_t algorithm = ntohl(header[2]);
+        uint32_t len = ntohl(header[3]);
+        if ((FILTER_SERVER_MAGIC != magic) || (dim <= 1) || (dim > FILTER_SERVER_MAX_DIM) ||
+                (0 == len) || (len > FILTER_SERVER_MAX_PAYLOAD)) {
+            send_response(fd, FILTER_STATUS_BAD_REQUEST, NULL, 0);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            record_latency(&w->server->stats, elapsed_ms(&start, &end), TRUE);
+            return;
+        }
+
+        if (len > w->req_capacity) {
+            unsigned char* buf = (unsigned char*)realloc(w->req_buf, len);
+            if (!buf) {
+                fprintf(stderr, "unable to allocate %u byte request buffer\n", len);
+                return;
+            }
+            w->req_buf = buf;
+            w->req_capacity = len;
+        }
+        if (read_full(fd, w->req_buf, len))
+            return;
+
+        uint32_t status = filter_request(w, dim, algorithm, len);
+        int send_failed = (FILTER_STATUS_OK == status) ?
+            send_response(fd, status, w->enc.data, (uint32_t)w->enc.size) :
+            send_response(fd, status, NULL, 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        record_latency(&w->server->stats, elapsed_ms(&start, &end), FILTER_STATUS_OK != status);
+#ifdef MEDFILTER_COUNTERS
+        __atomic_fetch_add(&w->busy_ns, (uint64_t)(elapsed_ms(&start, &end) * 1000000.0), __ATOMIC_RELAXED);
+#endif
+        if (send_failed)
+            return;
+    }
+}
+
+static int server_stopping(struct filter_server_t* server)
+{
+    pthread_mutex_lock(&server->lock);
+    int stop = server->stop;
+    pthread_mutex_unlock(&server->lock);
+    return stop;
+}
+
+static void* worker_main(void* arg)
+{
+    struct worker_t* w = (struct worker_t*)arg;
+
+    while (!server_stopping(w->server)) {
+        int fd = accept(w->server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if ((EINTR == errno) || (ECONNABORTED == errno))
+                continue;
+            if (server_stopping(w->server))
+                break;
+
+            // Errors such as EMFILE persist until a descriptor is freed, so back off instead of spinning.
+            perror("accept");
+            struct timespec backoff = {0, ACCEPT_BACKOFF_MS * 1000000L};
+            nanosleep(&backoff, NULL);
+            continue;
+        }
+
+        // Bound every read so that an idle or stalled client gives its worker back.
+        struct timeval timeout = {FILTER_SERVER_IDLE_TIMEOUT_S, 0};
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))) {
+            perror("setsockopt");
+            close(fd);
+            continue;
+        }
+
+        // Publish the connection before rechecking the stop flag. The shutdown path sets the flag
+        // and then closes published connections so one of the two always ends this connection.
+        pthread_mutex_lock(&w->lock);
+        w->conn_fd = fd;
+        pthread_mutex_unlock(&w->lock);
+
+        if (!server_stopping(w->server))
+            serve_connection(w, fd);
+
+        pthread_mutex_lock(&w->lock);
+        w->conn_fd = -1;
+        close(fd);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+static int open_listen_socket(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    unlink(path); // Remove a socket left behind by a previous run.
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, SOMAXCONN)) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void stop_workers(struct filter_server_t* server, uint32_t nworkers)
+{
+    pthread_mutex_lock(&server->lock);
+    server->stop = TRUE;
+    pthread_mutex_unlock(&server->lock);
+
+    // Wake workers blocked in accept() or in the middle of a connection.
+    shutdown(server->listen_fd, SHUT_RDWR);
+    for (uint32_t i = 0; i < nworkers; ++i) {
+        pthread_mutex_lock(&server->workers[i].lock);
+        if (server->workers[i].conn_fd >= 0)
+            shutdown(server->workers[i].conn_fd, SHUT_RDWR);
+        pthread_mutex_unlock(&server->workers[i].lock);
+    }
+
+    for (uint32_t i = 0; i < nworkers; ++i)
+        pthread_join(server->workers[i].tid, NULL);
+}
+
+int run_filter_server(const struct filter_server_config_t* config)
+{
+    int ret = 0;
+    uint32_t started = 0;
+    sigset_t sigs;
+
+    struct filter_server_t* server = (struct filter_server_t*)calloc(1, sizeof(struct filter_server_t));
+    if (!server) {
+        fprintf(stderr, "unable to allocate filter server\n");
+        return 1;
+    }
+    server->config = config;
+    clock_gettime(CLOCK_MONOTONIC, &server->started);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_mutex_init(&server->stats.lock, NULL);
+
+    server->workers = (struct worker_t*)calloc(config->nthreads, sizeof(struct worker_t));
+    if (!server->workers) {
+        fprintf(stderr, "unable to allocate %u workers\n", config->nthreads);
+        free(server);
+        return 1;
+    }
+
+    if ((server->listen_fd = open_listen_socket(config->socket_path)) < 0) {
+        free(server->workers);
+        free(server);
+        return 1;
+    }
+
+    // Workers inherit this mask so that only the thread below ever sees these signals.
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    for (started = 0; started < config->nthreads; ++started) {
+        struct worker_t* w = &server->workers[started];
+        w->conn_fd = -1;
+        w->server = server;
+        pthread_mutex_init(&w->lock, NULL);
+        if (pthread_create(&w->tid, NULL, worker_main, w)) {
+            fprintf(stderr, "unable to start worker %u\n", started);
+            ret = 1;
+            break;
+        }
+    }
+    server->nstarted = started;
+
+    if (!ret) {
+        printf("Filter server listening on %s with %u worker(s).\n", config->socket_path, config->nthreads);
+        fflush(stdout);
+
+        int sig = 0;
+        while (!sigwait(&sigs, &sig) && (SIGUSR1 == sig)) {
+            if (config->print_stats)
+                print_server_stats(server);
+        }
+    }
+
+    stop_workers(server, started);
+    close(server->listen_fd);
+    unlink(config->socket_path);
+
+    if (config->print_stats)
+        print_server_stats(server);
+
+    for (uint32_t i = 0; i < started; ++i) {
+        free(server->workers[i].req_buf);
+        free_image(&server->workers[i].src);
+        free_image(&server->workers[i].dst);
+        free_jpeg_buffer(&server->workers[i].enc);
+        free_kernel(&server->workers[i].kernel);
+    }
+    free(server->workers);
+    free(server);
+
+    return ret;
+}
@@ -8,9 +8,28 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <setjmp.h>
 #include <jpeglib.h>
+#include <jerror.h>
 #include "jpeg_helpers.h"
 
+/*!
+ * \brief libjpeg error manager that returns control to the caller instead of exiting.
+ */
+struct jpeg_error_jmp_t
+{
+    struct jpeg_error_mgr pub; /*!< Standard libjpeg error fields. Must be the first member. */
+    jmp_buf jmpbuf; /*!< Context restored on a fatal libjpeg error. */
+};
+
+static void error_exit_jmp(j_common_ptr cinfo)
+{
+    struct jpeg_error_jmp_t* err = (struct jpeg_error_jmp_t*)cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jmpbuf, 1);
+}
+
 static void free_decompress_resources(struct jpeg_decompress_struct* cinfo, FILE* infile)
 {
     jpeg_finish_decompress(cinfo);
@@ -18,12 +37,36 @@ static void free_decompress_resources(struct jpeg_decompress_struct* cinfo, FILE
     fclose(infile);
 }
 
+static int decode_scanlines(struct jpeg_decompress_struct* cinfo, struct grayscale_image_t* img)
+{
+    JSAMPARRAY buffer = NULL; // Output row buffer.
+    uint32_t row_stride = 0; // Physical row width in output buffer.
+
+    // Allocate space to buffer the image pixels.
+    if (reserve_image(img, cinfo->output_width, cinfo->output_height)) {
+        fprintf(stderr, "Insufficient memory available for JPEG conversion.\n");
+        return 1;
+    }
+
+    row_stride = img->width * cinfo->output_components;
+    buffer = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE, row_stride, 1);
+    while (cinfo->output_scanline < cinfo->output_height) {
+        jpeg_read_scanlines(cinfo, buffer, 1);
+        for (int i = 0; i < img->width; ++i)
+            img->pixelmat[cinfo->output_scanline-1][i] = buffer[0][cinfo->output_components * i];
+    }
+
+    return 0;
+}
+
 int alloc_image(struct grayscale_image_t* img, uint32_t w, uint32_t h)
 {
     img->width = w;
     img->height = h;
+    img->row_capacity = 0;
+    img->col_capacity = w;
 
-    img->pixelmat = (JSAMPROW*)malloc(sizeof(JSAMPROW) * img->height);
+    img->pixelmat = (JSAMPROW*)calloc(img->height, sizeof(JSAMPROW));
     if (!img->pixelmat) {
         fprintf(stderr, "Insufficient memory available for JPEG conversion.\n");
         free_image(img);
@@ -37,6 +80,7 @@ int alloc_image(struct grayscale_image_t* img, uint32_t w, uint32_t h)
             free_image(img);
             return 1;
         }
+        img->row_capacity++;
         memset(img->pixelmat[i], 0, sizeof(JSAMPLE) * img->width);
     }
     return 0;
@@ -47,7 +91,7 @@ void free_image(struct grayscale_image_t* img)
     if (!img)
         return;
 
-    for (int i = 0; i < img->height; ++i) {
+    for (int i = 0; i < img->row_capacity; ++i) {
         free(img->pixelmat[i]);
     }
     free(img->pixelmat);
@@ -55,6 +99,23 @@ void free_image(struct grayscale_image_t* img)
     img->width = 0;
     img->height = 0;
     img->pixelmat = NULL;
+    img->row_capacity = 0;
+    img->col_capacity = 0;
+}
+
+int reserve_image(struct grayscale_image_t* img, uint32_t w, uint32_t h)
+{
+    if (!img->pixelmat || (w > img->col_capacity) || (h > img->row_capacity)) {
+        free_image(img);
+        return alloc_image(img, w, h);
+    }
+
+    img->width = w;
+    img->height = h;
+    for (int i = 0; i < img->height; ++i)
+        memset(img->pixelmat[i], 0, sizeof(JSAMPLE) * img->width);
+
+    return 0;
 }
 
 int read_jpeg(const char* filename, struct grayscale_image_t* img)
@@ -62,9 +123,6 @@ int read_jpeg(const char* filename, struct grayscale_image_t* img)
     struct jpeg_error_mgr jerr;
     struct jpeg_decompress_struct cinfo;
     FILE* infile = NULL; // Image source file.
-    JSAMPARRAY buffer = NULL; // Output row buffer.
-    uint32_t row_stride = 0; // Physical row width in output buffer.
-    unsigned char grayscale = 0;
 
     if (NULL == (infile = fopen(filename, "rb"))) {
         fprintf(stderr, "cannot open file %s\n", filename);
@@ -77,23 +135,83 @@ int read_jpeg(const char* filename, struct grayscale_image_t* img)
     jpeg_read_header(&cinfo, TRUE); // Read the file parameters.
     jpeg_start_decompress(&cinfo); // Start the decompressor.
 
-    // Allocate space to buffer the image pixels.
-    if (alloc_image(img, cinfo.output_width, cinfo.output_height)) {
-        fprintf(stderr, "Insufficient memory available for JPEG conversion.\n");
+    if (decode_scanlines(&cinfo, img)) {
         free_decompress_resources(&cinfo, infile);
         return 1;
     }
+    free_decompress_resources(&cinfo, infile);
 
-    row_stride = img->width * cinfo.output_components;
-    buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
-    while (cinfo.output_scanline < cinfo.output_height) {
+    return 0;
+}
+
+int read_jpeg_region(const char* filename, struct grayscale_image_t* img, struct image_roi_t* region)
+{
+    struct jpeg_error_mgr jerr;
+    struct jpeg_decompress_struct cinfo;
+    FILE* infile = NULL; // Image source file.
+    JSAMPARRAY buffer = NULL; // Output row buffer.
+    JDIMENSION xoffset = 0; // First decoded column of region.
+    JDIMENSION width = 0; // Number of decoded columns.
+    JDIMENSION skip_cols = 0; // Columns to skip at the start of each scanline.
+
+    if (NULL == (infile = fopen(filename, "rb"))) {
+        fprintf(stderr, "cannot open file %s\n", filename);
+        return 1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, infile);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    if ((region->x >= cinfo.output_width) || (region->y >= cinfo.output_height) ||
+            (0 == region->width) || (0 == region->height)) {
+        fprintf(stderr, "region (%u,%u %ux%u) lies outside the %ux%u image %s\n", region->x, region->y,
+                region->width, region->height, cinfo.output_width, cinfo.output_height, filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(infile);
+        return 1;
+    }
+    if (region->width > cinfo.output_width - region->x)
+        region->width = cinfo.output_width - region->x;
+    if (region->height > cinfo.output_height - region->y)
+        region->height = cinfo.output_height - region->y;
+
+    xoffset = region->x;
+    width = region->width;
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && (LIBJPEG_TURBO_VERSION_NUMBER >= 1005000)
+    // Both calls only do the entropy decoding needed to stay in sync for the rows and columns skipped.
+    jpeg_crop_scanline(&cinfo, &xoffset, &width);
+    jpeg_skip_scanlines(&cinfo, region->y);
+    buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+            cinfo.output_width * cinfo.output_components, 1);
+#else
+    skip_cols = xoffset;
+    buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+            cinfo.output_width * cinfo.output_components, 1);
+    while (cinfo.output_scanline < region->y)
         jpeg_read_scanlines(&cinfo, buffer, 1);
-        for (int i = 0; i < img->width; ++i) {
-            grayscale = buffer[0][cinfo.output_components * i];
-            img->pixelmat[cinfo.output_scanline-1][i] = grayscale;
-        }
+#endif
+
+    if (reserve_image(img, width, region->height)) {
+        fprintf(stderr, "Insufficient memory available for JPEG conversion.\n");
+        jpeg_destroy_decompress(&cinfo);
+        fclose(infile);
+        return 1;
     }
-    free_decompress_resources(&cinfo, infile);
+
+    for (int row = 0; row < img->height; ++row) {
+        jpeg_read_scanlines(&cinfo, buffer, 1);
+        for (int i = 0; i < img->width; ++i)
+            img->pixelmat[row][i] = buffer[0][cinfo.output_components * (skip_cols + i)];
+    }
+    region->x = xoffset;
+    region->width = width;
+
+    // The rows below region are never decoded so the decompressor is torn down without finishing.
+    jpeg_destroy_decompress(&cinfo);
+    fclose(infile);
 
     return 0;
 }
@@ -133,3 +251,140 @@ int write_jpeg(const char* filename, const struct grayscale_image_t* img, uint32
 
     return 0;
 }
+
+int read_jpeg_mem(const unsigned char* buf, unsigned long size, struct grayscale_image_t* img)
+{
+    struct jpeg_error_jmp_t jerr;
+    struct jpeg_decompress_struct cinfo;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit_jmp;
+    if (setjmp(jerr.jmpbuf)) {
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)buf, size);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    if (decode_scanlines(&cinfo, img)) {
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return 0;
+}
+
+/*!
+ * \brief Initial size of a jpeg_buffer_t that has not been allocated yet.
+ */
+#define JPEG_BUFFER_MIN_CAPACITY 4096
+
+/*!
+ * \brief libjpeg destination manager that encodes straight into a jpeg_buffer_t.
+ * \details The buffer is grown with realloc() and stays owned by the jpeg_buffer_t throughout, so a
+ *          failed encode can never leave behind an allocation that only libjpeg knows about.
+ */
+struct jpeg_dest_buffer_t
+{
+    struct jpeg_destination_mgr pub; /*!< Standard libjpeg destination fields. Must be the first member. */
+    struct jpeg_buffer_t* out; /*!< Buffer receiving the encoded image. */
+};
+
+static int grow_jpeg_buffer(struct jpeg_buffer_t* buf, unsigned long capacity)
+{
+    unsigned char* data = realloc(buf->data, capacity);
+    if (!data)
+        return 1;
+
+    buf->data = data;
+    buf->capacity = capacity;
+    return 0;
+}
+
+static void init_destination_buffer(j_compress_ptr cinfo)
+{
+    struct jpeg_dest_buffer_t* dest = (struct jpeg_dest_buffer_t*)cinfo->dest;
+
+    if (dest->out->capacity < JPEG_BUFFER_MIN_CAPACITY &&
+            grow_jpeg_buffer(dest->out, JPEG_BUFFER_MIN_CAPACITY))
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    dest->pub.next_output_byte = dest->out->data;
+    dest->pub.free_in_buffer = dest->out->capacity;
+}
+
+static boolean empty_destination_buffer(j_compress_ptr cinfo)
+{
+    struct jpeg_dest_buffer_t* dest = (struct jpeg_dest_buffer_t*)cinfo->dest;
+    unsigned long used = dest->out->capacity; // libjpeg only calls this once the buffer is full.
+
+    if (grow_jpeg_buffer(dest->out, 2 * used))
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 1);
+    dest->pub.next_output_byte = dest->out->data + used;
+    dest->pub.free_in_buffer = dest->out->capacity - used;
+
+    return TRUE;
+}
+
+static void term_destination_buffer(j_compress_ptr cinfo)
+{
+    struct jpeg_dest_buffer_t* dest = (struct jpeg_dest_buffer_t*)cinfo->dest;
+
+    dest->out->size = dest->out->capacity - dest->pub.free_in_buffer;
+}
+
+int write_jpeg_mem(struct jpeg_buffer_t* out, const struct grayscale_image_t* img, uint32_t quality)
+{
+    struct jpeg_error_jmp_t jerr;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_dest_buffer_t dest;
+    JSAMPROW row_pointer[1];
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit_jmp;
+    if (setjmp(jerr.jmpbuf)) {
+        // Whatever the encoder grew is already in out, which the caller frees with free_jpeg_buffer().
+        jpeg_destroy_compress(&cinfo);
+        return 1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    dest.pub.init_destination = init_destination_buffer;
+    dest.pub.empty_output_buffer = empty_destination_buffer;
+    dest.pub.term_destination = term_destination_buffer;
+    dest.out = out;
+    cinfo.dest = &dest.pub;
+
+    cinfo.image_width = img->width;
+    cinfo.image_height = img->height;
+    cinfo.input_components = 1;
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        row_pointer[0] = img->pixelmat[cinfo.next_scanline];
+        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+
+    jpeg_finish_compress(&cinfo); // Sets out->size via term_destination_buffer().
+    jpeg_destroy_compress(&cinfo);
+
+    return 0;
+}
+
+void free_jpeg_buffer(struct jpeg_buffer_t* buf)
+{
+    if (!buf)
+        return;
+
+    free(buf->data);
+    buf->data = NULL;
+    buf->size = 0;
+    buf->capacity = 0;
+}
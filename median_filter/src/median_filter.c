@@ -7,9 +7,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <stddef.h>
 #include <jpeglib.h>
 #include "jpeg_helpers.h"
 #include "median_filter.h"
+#include "filter_counters.h"
 
 static int jsamplecmp(const void* a, const void* b)
 {
@@ -22,29 +25,481 @@ static int jsamplecmp(const void* a, const void* b)
     return (ai < bi) ? -1 : 1;
 }
 
-int compute_median_filter(struct grayscale_image_t* dst, const struct grayscale_image_t* src, uint32_t dim)
+// Compare-exchange leaving the smaller value in a. Compiles down to a branchless min/max pair.
+#define PIX_SORT(a, b) { JSAMPLE lo_ = ((a) < (b)) ? (a) : (b); (b) = ((a) < (b)) ? (b) : (a); (a) = lo_; }
+
+/*!
+ * \brief Signature shared by the fixed size median selection networks below.
+ */
+typedef JSAMPLE (*median_network_t)(JSAMPLE* p);
+
+static JSAMPLE median3(JSAMPLE* p)
+{
+    PIX_SORT(p[0], p[1]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[0], p[1]);
+    return p[1];
+}
+
+static JSAMPLE median5(JSAMPLE* p)
+{
+    PIX_SORT(p[0], p[1]);
+    PIX_SORT(p[3], p[4]);
+    PIX_SORT(p[0], p[3]);
+    PIX_SORT(p[1], p[4]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[2], p[3]);
+    PIX_SORT(p[1], p[2]);
+    return p[2];
+}
+
+static JSAMPLE median7(JSAMPLE* p)
+{
+    PIX_SORT(p[0], p[5]);
+    PIX_SORT(p[0], p[3]);
+    PIX_SORT(p[1], p[6]);
+    PIX_SORT(p[2], p[4]);
+    PIX_SORT(p[0], p[1]);
+    PIX_SORT(p[3], p[5]);
+    PIX_SORT(p[2], p[6]);
+    PIX_SORT(p[2], p[3]);
+    PIX_SORT(p[3], p[6]);
+    PIX_SORT(p[4], p[5]);
+    PIX_SORT(p[1], p[4]);
+    PIX_SORT(p[1], p[3]);
+    PIX_SORT(p[3], p[4]);
+    return p[3];
+}
+
+static JSAMPLE median9(JSAMPLE* p)
+{
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[4], p[5]);
+    PIX_SORT(p[7], p[8]);
+    PIX_SORT(p[0], p[1]);
+    PIX_SORT(p[3], p[4]);
+    PIX_SORT(p[6], p[7]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[4], p[5]);
+    PIX_SORT(p[7], p[8]);
+    PIX_SORT(p[0], p[3]);
+    PIX_SORT(p[5], p[8]);
+    PIX_SORT(p[4], p[7]);
+    PIX_SORT(p[3], p[6]);
+    PIX_SORT(p[1], p[4]);
+    PIX_SORT(p[2], p[5]);
+    PIX_SORT(p[4], p[7]);
+    PIX_SORT(p[4], p[2]);
+    PIX_SORT(p[6], p[4]);
+    PIX_SORT(p[4], p[2]);
+    return p[4];
+}
+
+// Batcher's odd-even merge sort on 32 inputs with the 7 padding inputs and every comparator that
+// does not feed the middle output removed.
+static JSAMPLE median25(JSAMPLE* p)
+{
+    PIX_SORT(p[0], p[1]);
+    PIX_SORT(p[2], p[3]);
+    PIX_SORT(p[4], p[5]);
+    PIX_SORT(p[6], p[7]);
+    PIX_SORT(p[8], p[9]);
+    PIX_SORT(p[10], p[11]);
+    PIX_SORT(p[12], p[13]);
+    PIX_SORT(p[14], p[15]);
+    PIX_SORT(p[16], p[17]);
+    PIX_SORT(p[18], p[19]);
+    PIX_SORT(p[20], p[21]);
+    PIX_SORT(p[22], p[23]);
+    PIX_SORT(p[0], p[2]);
+    PIX_SORT(p[1], p[3]);
+    PIX_SORT(p[4], p[6]);
+    PIX_SORT(p[5], p[7]);
+    PIX_SORT(p[8], p[10]);
+    PIX_SORT(p[9], p[11]);
+    PIX_SORT(p[12], p[14]);
+    PIX_SORT(p[13], p[15]);
+    PIX_SORT(p[16], p[18]);
+    PIX_SORT(p[17], p[19]);
+    PIX_SORT(p[20], p[22]);
+    PIX_SORT(p[21], p[23]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[5], p[6]);
+    PIX_SORT(p[9], p[10]);
+    PIX_SORT(p[13], p[14]);
+    PIX_SORT(p[17], p[18]);
+    PIX_SORT(p[21], p[22]);
+    PIX_SORT(p[0], p[4]);
+    PIX_SORT(p[1], p[5]);
+    PIX_SORT(p[2], p[6]);
+    PIX_SORT(p[3], p[7]);
+    PIX_SORT(p[8], p[12]);
+    PIX_SORT(p[9], p[13]);
+    PIX_SORT(p[10], p[14]);
+    PIX_SORT(p[11], p[15]);
+    PIX_SORT(p[16], p[20]);
+    PIX_SORT(p[17], p[21]);
+    PIX_SORT(p[18], p[22]);
+    PIX_SORT(p[19], p[23]);
+    PIX_SORT(p[2], p[4]);
+    PIX_SORT(p[3], p[5]);
+    PIX_SORT(p[10], p[12]);
+    PIX_SORT(p[11], p[13]);
+    PIX_SORT(p[18], p[20]);
+    PIX_SORT(p[19], p[21]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[3], p[4]);
+    PIX_SORT(p[5], p[6]);
+    PIX_SORT(p[9], p[10]);
+    PIX_SORT(p[11], p[12]);
+    PIX_SORT(p[13], p[14]);
+    PIX_SORT(p[17], p[18]);
+    PIX_SORT(p[19], p[20]);
+    PIX_SORT(p[21], p[22]);
+    PIX_SORT(p[0], p[8]);
+    PIX_SORT(p[1], p[9]);
+    PIX_SORT(p[2], p[10]);
+    PIX_SORT(p[3], p[11]);
+    PIX_SORT(p[4], p[12]);
+    PIX_SORT(p[5], p[13]);
+    PIX_SORT(p[6], p[14]);
+    PIX_SORT(p[7], p[15]);
+    PIX_SORT(p[16], p[24]);
+    PIX_SORT(p[4], p[8]);
+    PIX_SORT(p[5], p[9]);
+    PIX_SORT(p[6], p[10]);
+    PIX_SORT(p[7], p[11]);
+    PIX_SORT(p[20], p[24]);
+    PIX_SORT(p[2], p[4]);
+    PIX_SORT(p[3], p[5]);
+    PIX_SORT(p[6], p[8]);
+    PIX_SORT(p[7], p[9]);
+    PIX_SORT(p[10], p[12]);
+    PIX_SORT(p[11], p[13]);
+    PIX_SORT(p[18], p[20]);
+    PIX_SORT(p[19], p[21]);
+    PIX_SORT(p[22], p[24]);
+    PIX_SORT(p[1], p[2]);
+    PIX_SORT(p[3], p[4]);
+    PIX_SORT(p[5], p[6]);
+    PIX_SORT(p[7], p[8]);
+    PIX_SORT(p[9], p[10]);
+    PIX_SORT(p[11], p[12]);
+    PIX_SORT(p[13], p[14]);
+    PIX_SORT(p[17], p[18]);
+    PIX_SORT(p[19], p[20]);
+    PIX_SORT(p[21], p[22]);
+    PIX_SORT(p[23], p[24]);
+    PIX_SORT(p[0], p[16]);
+    PIX_SORT(p[1], p[17]);
+    PIX_SORT(p[2], p[18]);
+    PIX_SORT(p[3], p[19]);
+    PIX_SORT(p[4], p[20]);
+    PIX_SORT(p[5], p[21]);
+    PIX_SORT(p[6], p[22]);
+    PIX_SORT(p[7], p[23]);
+    PIX_SORT(p[8], p[24]);
+    PIX_SORT(p[8], p[16]);
+    PIX_SORT(p[9], p[17]);
+    PIX_SORT(p[10], p[18]);
+    PIX_SORT(p[11], p[19]);
+    PIX_SORT(p[12], p[20]);
+    PIX_SORT(p[13], p[21]);
+    PIX_SORT(p[6], p[10]);
+    PIX_SORT(p[7], p[11]);
+    PIX_SORT(p[12], p[16]);
+    PIX_SORT(p[13], p[17]);
+    PIX_SORT(p[10], p[12]);
+    PIX_SORT(p[11], p[13]);
+    PIX_SORT(p[11], p[12]);
+    return p[12];
+}
+
+static median_network_t find_median_network(uint32_t nsamples)
+{
+    switch (nsamples) {
+        case 3: return median3;
+        case 5: return median5;
+        case 7: return median7;
+        case 9: return median9;
+        case 25: return median25;
+        default: return NULL;
+    }
+}
+
+static int build_kernel(struct filter_kernel_t* kernel, uint32_t dim, const uint8_t* weights)
+{
+    const int32_t EDGE = dim / 2;
+    uint32_t nsamples = 0;
+
+    kernel->dim = 0;
+    kernel->nsamples = 0;
+    kernel->row_offsets = NULL;
+    kernel->col_offsets = NULL;
+
+    for (uint32_t i = 0; i < dim * dim; ++i)
+        nsamples += weights[i];
+    if (0 == nsamples) {
+        fprintf(stderr, "filter kernel must contain at least one sample\n");
+        return 1;
+    }
+
+    kernel->row_offsets = (int32_t*)malloc(sizeof(int32_t) * nsamples);
+    kernel->col_offsets = (int32_t*)malloc(sizeof(int32_t) * nsamples);
+    if (!kernel->row_offsets || !kernel->col_offsets) {
+        fprintf(stderr, "unable to allocate a %u sample filter kernel\n", nsamples);
+        free_kernel(kernel);
+        return 1;
+    }
+
+    for (int32_t fx = 0; fx < dim; ++fx) {
+        for (int32_t fy = 0; fy < dim; ++fy) {
+            for (uint8_t w = 0; w < weights[fx * dim + fy]; ++w) {
+                kernel->row_offsets[kernel->nsamples] = fx - EDGE;
+                kernel->col_offsets[kernel->nsamples] = fy - EDGE;
+                kernel->nsamples++;
+            }
+        }
+    }
+    kernel->dim = dim;
+
+    return 0;
+}
+
+static int make_shaped_kernel(struct filter_kernel_t* kernel, uint32_t dim, uint32_t center_weight, int cross)
+{
+    if ((dim <= 1) || (center_weight > UINT8_MAX)) {
+        fprintf(stderr, "illegal kernel dimension (%u) or center weight (%u)\n", dim, center_weight);
+        return 1;
+    }
+
+    uint8_t* weights = (uint8_t*)malloc(dim * dim);
+    if (!weights) {
+        fprintf(stderr, "unable to allocate a %ux%u filter kernel\n", dim, dim);
+        return 1;
+    }
+
+    for (uint32_t fx = 0; fx < dim; ++fx)
+        for (uint32_t fy = 0; fy < dim; ++fy)
+            weights[fx * dim + fy] = (!cross || (dim / 2 == fx) || (dim / 2 == fy));
+    weights[(dim / 2) * dim + (dim / 2)] = center_weight;
+
+    int ret = build_kernel(kernel, dim, weights);
+    free(weights);
+
+    return ret;
+}
+
+int make_square_kernel(struct filter_kernel_t* kernel, uint32_t dim, uint32_t center_weight)
+{
+    return make_shaped_kernel(kernel, dim, center_weight, FALSE);
+}
+
+int make_cross_kernel(struct filter_kernel_t* kernel, uint32_t dim, uint32_t center_weight)
+{
+    return make_shaped_kernel(kernel, dim, center_weight, TRUE);
+}
+
+int parse_kernel_mask(struct filter_kernel_t* kernel, const char* mask)
+{
+    const size_t DIM = strcspn(mask, "/");
+    const size_t LEN = strlen(mask);
+
+    // A DIM x DIM mask has DIM rows of DIM digits plus DIM - 1 separators.
+    if ((0 == DIM % 2) || (LEN != DIM * DIM + DIM - 1)) {
+        fprintf(stderr, "kernel mask must describe a square of odd dimension: %s\n", mask);
+        return 1;
+    }
+
+    uint8_t* weights = (uint8_t*)malloc(DIM * DIM);
+    if (!weights) {
+        fprintf(stderr, "unable to allocate a %zux%zu filter kernel\n", DIM, DIM);
+        return 1;
+    }
+
+    for (size_t i = 0; i < LEN; ++i) {
+        const int IS_SEPARATOR = (DIM == i % (DIM + 1));
+        if ((IS_SEPARATOR && ('/' != mask[i])) || (!IS_SEPARATOR && ((mask[i] < '0') || (mask[i] > '9')))) {
+            fprintf(stderr, "illegal character '%c' in kernel mask: %s\n", mask[i], mask);
+            free(weights);
+            return 1;
+        }
+        if (!IS_SEPARATOR)
+            weights[(i / (DIM + 1)) * DIM + (i % (DIM + 1))] = mask[i] - '0';
+    }
+
+    int ret = build_kernel(kernel, DIM, weights);
+    free(weights);
+
+    return ret;
+}
+
+void free_kernel(struct filter_kernel_t* kernel)
+{
+    if (!kernel)
+        return;
+
+    free(kernel->row_offsets);
+    free(kernel->col_offsets);
+    kernel->dim = 0;
+    kernel->nsamples = 0;
+    kernel->row_offsets = NULL;
+    kernel->col_offsets = NULL;
+}
+
+/*!
+ * \brief Filter the \p roi rectangle of \p src into \p dst.
+ * \details A \p dst that already has the dimensions of \p roi is reused as is. Every one of its pixels is
+ *          either filtered or, within dim/2 of the \p src border, cleared, so it need not be zeroed first.
+ * \param changed If not NULL, set to the number of pixels inside \p count_roi that the filter changed.
+ * \param count_roi Rectangle of \p src over which \p changed is counted. Ignored if \p changed is NULL.
+ */
+static int median_filter_region(struct grayscale_image_t* dst, const struct grayscale_image_t* src,
+        const struct filter_kernel_t* kernel, const struct image_roi_t* roi, uint32_t* changed,
+        const struct image_roi_t* count_roi)
 {
-    if (alloc_image(dst, src->width, src->height)) {
+    if ((roi->x + roi->width > src->width) || (roi->y + roi->height > src->height)) {
+        fprintf(stderr, "filter region exceeds the %ux%u source image\n", src->width, src->height);
+        return 1;
+    }
+
+    const int REUSE = dst->pixelmat && (dst->width == roi->width) && (dst->height == roi->height);
+    if (!REUSE && reserve_image(dst, roi->width, roi->height)) {
         fprintf(stderr, "unable to allocate space to construct output JPG\n");
         return 1;
     }
 
-    const uint32_t EDGE = dim / 2;
-    const uint8_t WIN_SIZE = dim * dim;
+    // Pixels closer than EDGE to the border of src have an incomplete window and are left unfiltered.
+    const uint32_t EDGE = kernel->dim / 2;
+    const uint32_t WIN_SIZE = kernel->nsamples;
+    const int ROW_BEGIN = (roi->y > EDGE) ? roi->y : EDGE;
+    const int COL_BEGIN = (roi->x > EDGE) ? roi->x : EDGE;
+    const int ROW_END = (src->height < 2 * EDGE) ? 0 :
+        ((roi->y + roi->height < src->height - EDGE) ? roi->y + roi->height : src->height - EDGE);
+    const int COL_END = (src->width < 2 * EDGE) ? 0 :
+        ((roi->x + roi->width < src->width - EDGE) ? roi->x + roi->width : src->width - EDGE);
+    const median_network_t NETWORK = find_median_network(WIN_SIZE);
+    const int32_t* ROWS = kernel->row_offsets;
+    const int32_t* COLS = kernel->col_offsets;
     JSAMPLE window[WIN_SIZE];
-    for (int x = EDGE; x < (src->height - EDGE); ++x) {
-        for (int y = EDGE; y < (src->width - EDGE); ++y) {
-            int i = 0;
-            for (int fx = 0; fx < dim; ++fx) {
-                for (int fy = 0; fy < dim; ++fy) {
-                    window[i] = src->pixelmat[x + fx - EDGE][y + fy - EDGE];
-                    i++;
-                }
+    JSAMPLE median = 0;
+    uint32_t nchanged = 0;
+
+    // Clear the pixels of dst the loop below leaves unfiltered.
+    for (int x = 0; x < roi->height; ++x) {
+        const int ROW = roi->y + x;
+        if ((ROW < ROW_BEGIN) || (ROW >= ROW_END) || (COL_BEGIN >= COL_END)) {
+            memset(dst->pixelmat[x], 0, sizeof(JSAMPLE) * roi->width);
+        } else {
+            memset(dst->pixelmat[x], 0, sizeof(JSAMPLE) * (COL_BEGIN - roi->x));
+            memset(dst->pixelmat[x] + (COL_END - roi->x), 0, sizeof(JSAMPLE) * (roi->x + roi->width - COL_END));
+        }
+    }
+
+    const struct image_roi_t COUNT = (changed) ? *count_roi : *roi;
+    for (int x = ROW_BEGIN; x < ROW_END; ++x) {
+        const int COUNT_ROW = (x >= COUNT.y) && (x < COUNT.y + COUNT.height);
+        for (int y = COL_BEGIN; y < COL_END; ++y) {
+            for (uint32_t i = 0; i < WIN_SIZE; ++i)
+                window[i] = src->pixelmat[x + ROWS[i]][y + COLS[i]];
+
+            if (NETWORK) {
+                median = NETWORK(window);
+            } else {
+                qsort(window, WIN_SIZE, sizeof(JSAMPLE), jsamplecmp);
+                median = window[WIN_SIZE / 2];
             }
-            qsort(window, WIN_SIZE, sizeof(JSAMPLE), jsamplecmp);
-            dst->pixelmat[x][y] = window[WIN_SIZE / 2];
+            dst->pixelmat[x - roi->y][y - roi->x] = median;
+            nchanged += COUNT_ROW & (y >= COUNT.x) & (y < COUNT.x + COUNT.width) & (median != src->pixelmat[x][y]);
         }
     }
 
+    if (changed)
+        *changed = nchanged;
+
+#ifdef MEDFILTER_COUNTERS
+    const uint64_t PIXELS = ((ROW_END > ROW_BEGIN) && (COL_END > COL_BEGIN)) ?
+        (uint64_t)(ROW_END - ROW_BEGIN) * (COL_END - COL_BEGIN) : 0;
+    FILTER_COUNTER_ADD(filter_calls, 1);
+    FILTER_COUNTER_ADD(samples, PIXELS * WIN_SIZE);
+    if (NETWORK)
+        FILTER_COUNTER_ADD(network_pixels, PIXELS);
+    else
+        FILTER_COUNTER_ADD(sort_pixels, PIXELS);
+#endif
+
     return 0;
 }
+
+static void copy_region(struct grayscale_image_t* dst, const struct grayscale_image_t* src,
+        const struct image_roi_t* roi)
+{
+    for (int x = 0; x < roi->height; ++x)
+        memcpy(dst->pixelmat[x], src->pixelmat[roi->y + x] + roi->x, sizeof(JSAMPLE) * roi->width);
+}
+
+int compute_median_filter(struct grayscale_image_t* dst, const struct grayscale_image_t* src, uint32_t dim)
+{
+    struct image_roi_t frame = {0, 0, src->width, src->height};
+    struct filter_kernel_t kernel;
+    if (make_square_kernel(&kernel, dim, 1))
+        return 1;
+
+    int ret = median_filter_region(dst, src, &kernel, &frame, NULL, NULL);
+    free_kernel(&kernel);
+
+    return ret;
+}
+
+int compute_median_filter_roi(struct grayscale_image_t* dst, const struct grayscale_image_t* src,
+        const struct filter_kernel_t* kernel, const struct image_roi_t* roi)
+{
+    return median_filter_region(dst, src, kernel, roi, NULL, NULL);
+}
+
+int compute_median_filter_passes(struct grayscale_image_t* dst, struct grayscale_image_t* src,
+        const struct filter_kernel_t* kernel, const struct image_roi_t* roi, uint32_t passes, uint32_t min_changes,
+        uint32_t* passes_run)
+{
+    struct grayscale_image_t scratch = {0, 0, NULL, 0, 0};
+    struct grayscale_image_t* in = src;
+    struct grayscale_image_t* out = &scratch;
+    struct grayscale_image_t* tmp = NULL;
+    const struct image_roi_t FRAME = {0, 0, src->width, src->height};
+    uint32_t changed = 0;
+    uint32_t pass = 1;
+    int ret = 0;
+
+    // Every pass but the last filters the whole frame, ping-ponging between src and scratch. The
+    // buffers are the same size so after the first pass neither is ever reallocated or cleared. Only
+    // changes inside roi count toward early stopping, since the halo around it is never written out.
+    for (; pass < passes; ++pass) {
+        if (median_filter_region(out, in, kernel, &FRAME, &changed, roi)) {
+            ret = 1;
+            break;
+        }
+        tmp = in;
+        in = out;
+        out = tmp;
+
+        if (changed < min_changes)
+            break;
+    }
+
+    if (!ret) {
+        if (pass < passes) {
+            // Converged early. The latest pass already holds the result.
+            ret = reserve_image(dst, roi->width, roi->height);
+            if (!ret)
+                copy_region(dst, in, roi);
+        } else {
+            ret = median_filter_region(dst, in, kernel, roi, NULL, NULL);
+        }
+    }
+
+    if (passes_run)
+        *passes_run = (pass < passes) ? pass : passes;
+
+    free_image(&scratch);
+    return ret;
+}
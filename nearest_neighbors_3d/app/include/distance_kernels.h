@@ -0,0 +1,67 @@
+/*!
+ * \file distance_kernels.h
+ * \brief Declare the vectorized distance kernels used to scan ThreeDTree leaf buckets.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nnalgo
+{
+
+/*!
+ * \brief Largest number of points radius_mask() accepts in a single call.
+ */
+const std::size_t kRadiusMaskWidth = 64;
+
+/*!
+ * \brief Test a block of points against a search radius.
+ * \details The points are given in structure of arrays form so that a whole block can be streamed through
+ *          SIMD registers. radius_mask() uses AVX-512 or AVX2 when the CPU supports them (the choice is made
+ *          once, at first use) and falls back to scalar code otherwise. As with ThreeDTree::radial_search(),
+ *          a point at distance zero from the reference point is not reported.
+ * \param xs X coordinates of the block.
+ * \param ys Y coordinates of the block.
+ * \param zs Z coordinates of the block.
+ * \param n Number of points in the block. Must not exceed kRadiusMaskWidth.
+ * \param qx Reference point x coordinate.
+ * \param qy Reference point y coordinate.
+ * \param qz Reference point z coordinate.
+ * \param rad_squared The square of a nonnegative radius value.
+ * \return A bit mask where bit i is set if point i is within the radius of the reference point.
+ */
+std::uint64_t radius_mask(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double rad_squared);
+
+/*!
+ * \brief Compute the squared distance from a reference point to each point in a block.
+ * \details Like radius_mask(), squared_distances() selects an AVX-512, AVX2, or scalar implementation at
+ *          first use.
+ * \param xs X coordinates of the block.
+ * \param ys Y coordinates of the block.
+ * \param zs Z coordinates of the block.
+ * \param n Number of points in the block.
+ * \param qx Reference point x coordinate.
+ * \param qy Reference point y coordinate.
+ * \param qz Reference point z coordinate.
+ * \param dist_squared Output array with room for \p n values.
+ */
+void squared_distances(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double* dist_squared);
+
+/*!
+ * \brief Single precision variant of radius_mask().
+ * \details Processing floats doubles the number of points per SIMD register and halves memory traffic.
+ */
+std::uint64_t radius_mask(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float rad_squared);
+
+/*!
+ * \brief Single precision variant of squared_distances().
+ */
+void squared_distances(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float* dist_squared);
+
+} // end nnalgo
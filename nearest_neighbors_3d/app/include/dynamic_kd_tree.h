@@ -0,0 +1,342 @@
+/*!
+ * \file dynamic_kd_tree.h
+ * \brief Declare and define the DynamicKdTree container class template.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "kd_tree.h"
+
+namespace nnalgo
+{
+
+/*!
+ * \class DynamicKdTree
+ * \brief Declare the interface for a k-d tree which supports inserting and erasing points.
+ * \details DynamicKdTree implements the logarithmic method: points live in a forest of static KdTrees whose
+ *          sizes grow in powers of two, plus a small unsorted insert buffer of kInsertBufferSize points.
+ *          Level j of the forest holds at most kInsertBufferSize * 2^j points. When the buffer fills, it is
+ *          merged with every occupied level below the first empty level j, and the result is built into
+ *          level j, just like a carry propagating through a binary counter. Erased points are tombstoned in
+ *          the level holding them and dropped the next time that level is rebuilt. A level is rebuilt on its
+ *          own once more than half of its points are tombstones.
+ *
+ *          Costs, for n live points and B = kInsertBufferSize:
+ *          (1) insert() is amortized O(log(n) * log(n / B)). Each point takes part in at most log2(n / B)
+ *              merges, and each merge builds a KdTree in O(m log m) for its m points.
+ *          (2) erase() is O(1) expected, plus an amortized O(log n) share of the level rebuild it may trigger.
+ *          (3) Queries search every occupied level, at most log2(n / B) + 1 trees, and scan the buffer. A
+ *              radial query therefore costs up to O(log(n / B)) times as much tree descent as a single static
+ *              KdTree. Its leaf scans and reported neighbors cost about the same, but tombstones, at most half
+ *              of each level, are still scanned before they are filtered out.
+ *          Each point's level is tracked in a hash map by ID, so IDs must be unique among the live points.
+ */
+template <typename T, int K>
+class DynamicKdTree
+{
+public:
+    typedef KdTree<T, K> Tree; /*!< Static tree type of each level. */
+    typedef typename Tree::Point Point; /*!< Point type stored in and accepted by this tree. */
+
+    /*!
+     * \brief Number of inserted points buffered before they are merged into the forest.
+     */
+    static const std::size_t kInsertBufferSize = 256;
+
+    /*!
+     * \brief Construct an empty DynamicKdTree.
+     * \param leaf_size Maximum number of points stored in a leaf bucket of each level (see KdTree).
+     */
+    explicit DynamicKdTree(std::size_t leaf_size=32) : leaf_size_(leaf_size) { }
+
+    /*!
+     * \brief Construct a DynamicKdTree containing the points in \p coords.
+     * \details The points are bulk loaded into a single level. As with KdTree, the order of the elements in
+     *          \p coords is not preserved.
+     * \param coords A vector of points with unique IDs.
+     * \param leaf_size Maximum number of points stored in a leaf bucket of each level (see KdTree).
+     */
+    DynamicKdTree(std::vector<Point>& coords, std::size_t leaf_size=32);
+
+    /*!
+     * \brief DynamicKdTree is not copy constructable.
+     */
+    DynamicKdTree(const DynamicKdTree& tree) = delete;
+
+    /*!
+     * \brief DynamicKdTree does not support assignment.
+     */
+    DynamicKdTree& operator=(const DynamicKdTree& tree) = delete;
+
+    /*!
+     * \brief Get the number of live points stored in this tree.
+     */
+    std::size_t size() const { return where_.size(); }
+
+    /*!
+     * \brief Get the number of static trees currently in the forest.
+     */
+    std::size_t tree_count() const;
+
+    /*!
+     * \brief Add \p p to this tree.
+     * \return False, leaving this tree unchanged, if a point with the ID of \p p is already stored.
+     */
+    bool insert(const Point& p);
+
+    /*!
+     * \brief Remove the point with ID \p id from this tree.
+     * \return False if no point with ID \p id is stored.
+     */
+    bool erase(unsigned int id);
+
+    /*!
+     * \brief Find all the neighbors of \p ref within a search radius of size \p rad.
+     * \details See KdTree::radial_search(). Neighbors are appended level by level, in no particular order.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \param neighbors Vector used to store \p ref neighbors.
+     */
+    void radial_search(const Point& ref, T rad, std::vector<Point>& neighbors) const;
+
+    /*!
+     * \brief Find the \p k points closest to \p ref.
+     * \details See KdTree::knn_search(). Each level is searched for its own \p k nearest live points and the
+     *          candidates are merged.
+     * \param ref A reference point.
+     * \param k Number of neighbors to find.
+     * \param neighbors Vector to which the neighbors of \p ref are appended in order of increasing distance.
+     */
+    void knn_search(const Point& ref, std::size_t k, std::vector<Point>& neighbors) const;
+
+private:
+    /*!
+     * \struct Level
+     * \brief One static tree of the forest and the IDs erased from it since it was built.
+     */
+    struct Level
+    {
+        std::unique_ptr<Tree> tree_; /*!< Static tree, or null if this level is empty. */
+        std::unordered_set<unsigned int> erased_; /*!< Tombstoned IDs still stored in tree_. */
+    };
+
+    /*!
+     * \brief where_ value of points held in buffer_.
+     */
+    static const int kInBuffer = -1;
+
+    /*!
+     * \brief Compute the square of the distance between \p a and \p b.
+     */
+    static T distance_squared(const Point& a, const Point& b)
+    {
+        T dist_squared = 0;
+        for (int axis = 0; axis < K; ++axis)
+            dist_squared += (a[axis] - b[axis]) * (a[axis] - b[axis]);
+        return dist_squared;
+    }
+
+    /*!
+     * \brief Move the live points of \p level into \p coords and leave the level empty.
+     */
+    void drain_level(std::size_t level, std::vector<Point>& coords);
+
+    /*!
+     * \brief Build \p level from \p coords, which may be reordered.
+     */
+    void build_level(std::size_t level, std::vector<Point>& coords);
+
+    /*!
+     * \brief Merge buffer_ and the occupied levels below the first empty level into that level.
+     */
+    void flush_buffer();
+
+    std::size_t leaf_size_; /*!< Leaf bucket size of every level. */
+    std::vector<Point> buffer_; /*!< Inserted points not yet merged into a level. */
+    std::vector<Level> levels_; /*!< The forest. Level j holds at most kInsertBufferSize * 2^j points. */
+    std::unordered_map<unsigned int, int> where_; /*!< Level (or kInBuffer) of every live point, by ID. */
+}; // end DynamicKdTree
+
+template <typename T, int K>
+const std::size_t DynamicKdTree<T, K>::kInsertBufferSize;
+
+template <typename T, int K>
+const int DynamicKdTree<T, K>::kInBuffer;
+
+template <typename T, int K>
+DynamicKdTree<T, K>::DynamicKdTree(std::vector<Point>& coords, std::size_t leaf_size) : leaf_size_(leaf_size)
+{
+    std::size_t level = 0;
+    while ((kInsertBufferSize << level) < coords.size())
+        level++;
+    levels_.resize(level + 1);
+    where_.reserve(coords.size());
+    build_level(level, coords);
+}
+
+template <typename T, int K>
+std::size_t DynamicKdTree<T, K>::tree_count() const
+{
+    std::size_t count = 0;
+    for (const Level& level : levels_)
+        count += (level.tree_) ? 1 : 0;
+    return count;
+}
+
+template <typename T, int K>
+bool DynamicKdTree<T, K>::insert(const Point& p)
+{
+    if (!where_.emplace(p.id_, kInBuffer).second)
+        return false;
+
+    buffer_.push_back(p);
+    if (buffer_.size() >= kInsertBufferSize)
+        flush_buffer();
+    return true;
+}
+
+template <typename T, int K>
+bool DynamicKdTree<T, K>::erase(unsigned int id)
+{
+    auto it = where_.find(id);
+    if (where_.end() == it)
+        return false;
+
+    int level = it->second;
+    where_.erase(it);
+    if (kInBuffer == level) {
+        auto p = std::find_if(buffer_.begin(), buffer_.end(), [id](const Point& q) { return (q.id_ == id); });
+        *p = buffer_.back();
+        buffer_.pop_back();
+        return true;
+    }
+
+    // Rebuilding a level once half of it is dead keeps its tombstones from dominating query time.
+    Level& l = levels_[level];
+    l.erased_.insert(id);
+    if ((2 * l.erased_.size()) > l.tree_->size()) {
+        std::vector<Point> coords;
+        drain_level(level, coords);
+        build_level(level, coords);
+    }
+    return true;
+}
+
+template <typename T, int K>
+void DynamicKdTree<T, K>::radial_search(const Point& ref, T rad, std::vector<Point>& neighbors) const
+{
+    for (const Level& level : levels_) {
+        if (!level.tree_)
+            continue;
+        std::size_t first = neighbors.size();
+        level.tree_->radial_search(ref, rad, neighbors);
+        if (!level.erased_.empty()) {
+            auto erased = [&level](const Point& p) { return (0 != level.erased_.count(p.id_)); };
+            neighbors.erase(std::remove_if(neighbors.begin() + first, neighbors.end(), erased), neighbors.end());
+        }
+    }
+
+    const T rad_squared = rad * rad;
+    for (const Point& p : buffer_) {
+        T dist_squared = distance_squared(ref, p);
+        if ((dist_squared <= rad_squared) && (0 != dist_squared))
+            neighbors.push_back(p);
+    }
+}
+
+template <typename T, int K>
+void DynamicKdTree<T, K>::knn_search(const Point& ref, std::size_t k, std::vector<Point>& neighbors) const
+{
+    if (!k)
+        return;
+
+    std::vector<Point> candidates;
+    std::vector<Point> found;
+    for (const Level& level : levels_) {
+        if (!level.tree_)
+            continue;
+        // Ask for extra neighbors until k of them are live or the level runs out of points.
+        std::size_t want = k;
+        std::size_t live = 0;
+        for (;;) {
+            found.clear();
+            level.tree_->knn_search(ref, want, found);
+            live = 0;
+            for (const Point& p : found)
+                live += (0 == level.erased_.count(p.id_)) ? 1 : 0;
+            if ((live >= k) || (found.size() < want))
+                break;
+            want = k + (found.size() - live);
+        }
+        for (const Point& p : found) {
+            if (0 == level.erased_.count(p.id_))
+                candidates.push_back(p);
+        }
+    }
+    for (const Point& p : buffer_) {
+        if (0 != distance_squared(ref, p))
+            candidates.push_back(p);
+    }
+
+    std::vector<std::pair<T, std::size_t>> order;
+    order.reserve(candidates.size());
+    for (std::size_t i = 0; i < candidates.size(); ++i)
+        order.emplace_back(distance_squared(ref, candidates[i]), i);
+    std::size_t count = std::min(k, order.size());
+    std::partial_sort(order.begin(), order.begin() + count, order.end());
+    for (std::size_t i = 0; i < count; ++i)
+        neighbors.push_back(candidates[order[i].second]);
+}
+
+template <typename T, int K>
+void DynamicKdTree<T, K>::drain_level(std::size_t level, std::vector<Point>& coords)
+{
+    Level& l = levels_[level];
+    if (!l.tree_)
+        return;
+
+    std::size_t first = coords.size();
+    l.tree_->get_points(coords);
+    if (!l.erased_.empty()) {
+        auto erased = [&l](const Point& p) { return (0 != l.erased_.count(p.id_)); };
+        coords.erase(std::remove_if(coords.begin() + first, coords.end(), erased), coords.end());
+    }
+    l.tree_.reset();
+    l.erased_.clear();
+}
+
+template <typename T, int K>
+void DynamicKdTree<T, K>::build_level(std::size_t level, std::vector<Point>& coords)
+{
+    if (coords.empty())
+        return;
+
+    levels_[level].tree_.reset(new Tree(coords, 1, leaf_size_));
+    for (const Point& p : coords)
+        where_[p.id_] = static_cast<int>(level);
+}
+
+template <typename T, int K>
+void DynamicKdTree<T, K>::flush_buffer()
+{
+    std::vector<Point> coords;
+    coords.swap(buffer_);
+
+    std::size_t level = 0;
+    while ((level < levels_.size()) && levels_[level].tree_) {
+        drain_level(level, coords);
+        level++;
+    }
+    if (level == levels_.size())
+        levels_.emplace_back();
+    build_level(level, coords);
+}
+
+} // end nnalgo
@@ -0,0 +1,142 @@
+/*!
+ * \file kd_point.h
+ * \brief Declare the point types stored in a KdTree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace nnalgo
+{
+
+/*!
+ * \struct ThreeDPoint
+ * \brief Declare a type for storing 3D coordinate data.
+ */
+struct ThreeDPoint
+{
+    unsigned int id_; /*!< Unique integral ID identifying this point. */
+    double x_; /*!< X axis location. */
+    double y_; /*!< Y axis location. */
+    double z_; /*!< Z axis location. */
+
+    /*!
+     * \brief Default constructed ThreeDPoint.
+     * \details No non-default constructed ThreeDPoint should have ID of 0.
+     */
+    ThreeDPoint() : id_(0), x_(0.0), y_(0.0), z_(0.0) { }
+
+    /*!
+     * \brief Construct a ThreeDPoint with a set ID and location.
+     */
+    ThreeDPoint(unsigned id, double x, double y, double z) : id_(id), x_(x), y_(y), z_(z) { }
+
+    /*!
+     * \brief Determine whether \p a is further left on the x-axis than \p b.
+     * \return True if \p a is less than \p b with respect to x.
+     */
+    static bool compare_x(const ThreeDPoint& a, const ThreeDPoint& b) { return (a.x_ < b.x_); }
+
+    /*!
+     * \brief Determine whether \p a is further left on the y-axis than \p b.
+     * \return True if \p a is less than \p b with respect to y.
+     */
+    static bool compare_y(const ThreeDPoint& a, const ThreeDPoint& b) { return (a.y_ < b.y_); }
+
+    /*!
+     * \brief Determine whether \p a is further left on the z-axis than \p b.
+     * \return True if \p a is less than \p b with respect to z.
+     */
+    static bool compare_z(const ThreeDPoint& a, const ThreeDPoint& b) { return (a.z_ < b.z_); }
+
+    /*!
+     * \brief Overload [] to return the x, y, or z coordinate.
+     * \param i Integral index into the coordinate triplet.
+     * \return The coordinate mapped to \p i. Zero is returned if i is not in [0,2].
+     */
+    double operator[](int i) const
+    {
+        if (0 == i) return x_;
+        if (1 == i) return y_;
+        if (2 == i) return z_;
+        return 0;
+    }
+};
+
+/*!
+ * \struct KdPoint
+ * \brief Declare a type for storing K-dimensional coordinate data of scalar type T.
+ */
+template <typename T, int K>
+struct KdPoint
+{
+    unsigned int id_; /*!< Unique integral ID identifying this point. */
+    T coords_[K]; /*!< Location along each axis. */
+
+    /*!
+     * \brief Default constructed KdPoint.
+     * \details No non-default constructed KdPoint should have ID of 0.
+     */
+    KdPoint() : id_(0), coords_{} { }
+
+    /*!
+     * \brief Construct a KdPoint with a set ID and the location in \p coords[0, K).
+     */
+    KdPoint(unsigned id, const T* coords) : id_(id)
+    {
+        for (int i = 0; i < K; ++i)
+            coords_[i] = coords[i];
+    }
+
+    /*!
+     * \brief Overload [] to return the coordinate on axis \p i.
+     */
+    T operator[](int i) const { return coords_[i]; }
+};
+
+/*!
+ * \struct KdPointTraits
+ * \brief Map a KdTree's scalar type and dimension to the point type it stores and accesses.
+ * \details The general case uses KdPoint. KdTree<double, 3> uses ThreeDPoint, so that ThreeDTree keeps its
+ *          original interface. get<Axis>() is resolved at compile time, without the branches of
+ *          ThreeDPoint::operator[].
+ */
+template <typename T, int K>
+struct KdPointTraits
+{
+    typedef KdPoint<T, K> Point; /*!< Point type of a KdTree<T, K>. */
+
+    /*!
+     * \brief Get the coordinate of \p p on axis Axis.
+     */
+    template <int Axis>
+    static T get(const Point& p) { return p.coords_[Axis]; }
+
+    /*!
+     * \brief Construct a point with ID \p id located at \p coords[0, K).
+     */
+    static Point make(unsigned int id, const T* coords) { return Point(id, coords); }
+};
+
+/*!
+ * \brief ThreeDPoint specialization of KdPointTraits.
+ */
+template <>
+struct KdPointTraits<double, 3>
+{
+    typedef ThreeDPoint Point; /*!< Point type of a ThreeDTree. */
+
+    /*!
+     * \brief Get the coordinate of \p p on axis Axis.
+     */
+    template <int Axis>
+    static double get(const Point& p) { return (0 == Axis) ? p.x_ : ((1 == Axis) ? p.y_ : p.z_); }
+
+    /*!
+     * \brief Construct a point with ID \p id located at \p coords[0, 3).
+     */
+    static Point make(unsigned int id, const double* coords) { return Point(id, coords[0], coords[1], coords[2]); }
+};
+
+} // end nnalgo
@@ -0,0 +1,1537 @@
+/*!
+ * \file kd_tree.h
+ * \brief Declare and define the KdTree container class template.
+ */
+
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include "kd_point.h"
+#include "morton.h"
+#include "neighbor_lists.h"
+#include "distance_kernels.h"
+#include "thread_pool.h"
+
+namespace nnalgo
+{
+
+class MappedFile;
+
+namespace detail
+{
+
+/*!
+ * \brief Ranges smaller than this are partitioned on a single thread.
+ */
+const std::ptrdiff_t kParallelPartitionMin = 1 << 16;
+
+/*!
+ * \brief Subtrees with fewer points than this are built by a single task rather than split further.
+ */
+const std::size_t kParallelBuildMin = 1 << 14;
+
+/*!
+ * \brief A parallel build splits the top of the tree until it has this many subtrees per worker to hand out.
+ */
+const unsigned kSubtreesPerWorker = 4;
+
+/*!
+ * \brief Compute the index of the first of \p npoints points covered by node \p k on level \p depth.
+ * \details The result is floor(k * npoints / 2^depth). Deep levels of large trees need more than 64 bits
+ *          for the product (k reaches 2^32 for five billion points in buckets of one), so it is formed in
+ *          128 bits.
+ */
+inline std::size_t range_begin(std::size_t npoints, int depth, std::size_t k)
+{
+    return static_cast<std::size_t>((static_cast<unsigned __int128>(k) * npoints) >> depth);
+}
+
+/*!
+ * \brief Multithreaded equivalent of std::nth_element() run on the workers of \p pool.
+ * \details Performs a quickselect where each partition step is split across the workers in two batches. In
+ *          the first, every worker counts the elements of its chunk that fall below, equal to, and above the
+ *          pivot. In the second, it scatters them into a scratch buffer at offsets computed from those counts.
+ *          The next step's counting batch first copies its chunk of the narrowed range back from the scratch
+ *          buffer, and a last batch copies back the whole range once. Once the range containing \p nth drops
+ *          below kParallelPartitionMin, std::nth_element() finishes the selection.
+ */
+template <typename Iterator, typename Compare>
+void parallel_nth_element(Iterator first, Iterator nth, Iterator last, Compare comp, ThreadPool& pool)
+{
+    typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+    const unsigned nthreads = pool.size();
+    const Iterator origin = first;
+    const std::size_t size = last - first;
+    std::vector<Value> scratch(size);
+    std::vector<std::size_t> nless(nthreads);
+    std::vector<std::size_t> nequal(nthreads);
+    std::vector<std::size_t> ngreater(nthreads);
+    bool scattered = false;
+    while ((last - first) >= kParallelPartitionMin) {
+        const std::size_t offset = first - origin;
+        const std::size_t n = last - first;
+        const std::size_t chunk = (n + nthreads - 1) / nthreads;
+
+        // Median of three pivot. After a scatter, the range is only up to date in scratch.
+        const Value* values = scattered ? (scratch.data() + offset) : &*first;
+        Value a = values[0];
+        Value b = values[n / 2];
+        Value c = values[n - 1];
+        if (comp(b, a)) std::swap(a, b);
+        if (comp(c, b)) std::swap(b, c);
+        if (comp(b, a)) std::swap(a, b);
+        const Value pivot = b;
+
+        pool.run(nthreads, [&](std::size_t t, unsigned) {
+            std::size_t begin = std::min(n, t * chunk);
+            std::size_t end = std::min(n, begin + chunk);
+            if (scattered)
+                std::copy(scratch.begin() + offset + begin, scratch.begin() + offset + end, first + begin);
+            nless[t] = 0;
+            nequal[t] = 0;
+            ngreater[t] = 0;
+            for (std::size_t i = begin; i < end; ++i) {
+                if (comp(first[i], pivot))
+                    nless[t]++;
+                else if (!comp(pivot, first[i]))
+                    nequal[t]++;
+                else
+                    ngreater[t]++;
+            }
+        });
+
+        std::size_t total_less = 0;
+        std::size_t total_equal = 0;
+        for (unsigned t = 0; t < nthreads; ++t) {
+            total_less += nless[t];
+            total_equal += nequal[t];
+        }
+
+        pool.run(nthreads, [&](std::size_t t, unsigned) {
+            std::size_t begin = std::min(n, t * chunk);
+            std::size_t end = std::min(n, begin + chunk);
+            std::size_t less_pos = offset;
+            std::size_t equal_pos = offset + total_less;
+            std::size_t greater_pos = offset + total_less + total_equal;
+            for (unsigned u = 0; u < t; ++u) {
+                less_pos += nless[u];
+                equal_pos += nequal[u];
+                greater_pos += ngreater[u];
+            }
+            for (std::size_t i = begin; i < end; ++i) {
+                if (comp(first[i], pivot))
+                    scratch[less_pos++] = first[i];
+                else if (!comp(pivot, first[i]))
+                    scratch[equal_pos++] = first[i];
+                else
+                    scratch[greater_pos++] = first[i];
+            }
+        });
+        scattered = true;
+
+        const std::size_t k = nth - first;
+        if (k < total_less) {
+            last = first + total_less;
+        } else if (k < total_less + total_equal) {
+            first = nth;
+            last = nth;
+            break;
+        } else {
+            first = first + total_less + total_equal;
+        }
+    }
+
+    // Every step scattered its whole range, so scratch holds the current order of everything.
+    if (scattered) {
+        const std::size_t chunk = (size + nthreads - 1) / nthreads;
+        pool.run(nthreads, [&](std::size_t t, unsigned) {
+            std::size_t begin = std::min(size, t * chunk);
+            std::size_t end = std::min(size, begin + chunk);
+            std::copy(scratch.begin() + begin, scratch.begin() + end, origin + begin);
+        });
+    }
+    std::nth_element(first, nth, last, comp);
+}
+
+/*!
+ * \brief Distance kernels used to scan KdTree leaf buckets.
+ * \details The general case is plain scalar code. Three dimensional trees of float or double use the SIMD
+ *          kernels from distance_kernels.h.
+ */
+template <typename T, int K>
+struct LeafKernels
+{
+    /*!
+     * \brief See radius_mask(). Scans points [\p i, \p i + \p n) of the coordinate arrays \p coords.
+     */
+    static std::uint64_t radius_mask(const T* const* coords, std::size_t i, std::size_t n, const T* q,
+            T rad_squared)
+    {
+        std::uint64_t mask = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            T dist_squared = 0;
+            for (int axis = 0; axis < K; ++axis) {
+                T term = coords[axis][i + j] - q[axis];
+                dist_squared += term * term;
+            }
+            if ((dist_squared <= rad_squared) && (0 != dist_squared))
+                mask |= (std::uint64_t(1) << j);
+        }
+        return mask;
+    }
+
+    /*!
+     * \brief See squared_distances(). Scores points [\p i, \p i + \p n) of the coordinate arrays \p coords.
+     */
+    static void squared_distances(const T* const* coords, std::size_t i, std::size_t n, const T* q,
+            T* dist_squared)
+    {
+        for (std::size_t j = 0; j < n; ++j) {
+            dist_squared[j] = 0;
+            for (int axis = 0; axis < K; ++axis) {
+                T term = coords[axis][i + j] - q[axis];
+                dist_squared[j] += term * term;
+            }
+        }
+    }
+};
+
+/*!
+ * \brief Three dimensional LeafKernels, backed by the SIMD kernels.
+ */
+template <typename T>
+struct LeafKernels<T, 3>
+{
+    static std::uint64_t radius_mask(const T* const* coords, std::size_t i, std::size_t n, const T* q,
+            T rad_squared)
+    {
+        return nnalgo::radius_mask(&coords[0][i], &coords[1][i], &coords[2][i], n, q[0], q[1], q[2],
+                rad_squared);
+    }
+
+    static void squared_distances(const T* const* coords, std::size_t i, std::size_t n, const T* q,
+            T* dist_squared)
+    {
+        nnalgo::squared_distances(&coords[0][i], &coords[1][i], &coords[2][i], n, q[0], q[1], q[2],
+                dist_squared);
+    }
+};
+
+} // end detail
+
+/*!
+ * \class KdTree
+ * \brief Declare the interface for a k-d tree over K-dimensional points with coordinates of type T.
+ * \details KdTree exposes an interface which allows the user to:
+ *          (1) Construct a balanced, static k-d tree from of a set points in K-dimensional space.
+ *          (2) Perform radial queries (i.e., find all points within a specific radius of a reference point).
+ *          (3) Perform k-nearest neighbor queries (i.e., find the k points closest to a reference point).
+ *          (4) Perform radial queries for a whole batch of reference points on a thread pool.
+ *          (5) Find every pair of stored points within a specific radius of each other (a self-join).
+ *          (6) Count the neighbors of a reference point, or check whether it has any, without collecting them.
+ *          (7) Print the inorder traversal of the tree.
+ *          (8) Save the tree to a file which later processes memory-map and query in place (see save()), or
+ *              build such a file out of core from a point file too large for memory (see build_mapped()).
+ *              These members are defined in kd_tree_file.h, which only callers that save or map trees include.
+ *          Every node holds only the axis aligned bounding box of the points under it (plus, for fast descent,
+ *          its children's bounds on its split axis); the points themselves live in leaf buckets of at most
+ *          leaf_size points. The tree is complete, so it is stored implicitly in arrays using a breadth-first
+ *          layout: the children of the node at index i live at indices 2i + 1 and 2i + 2, and no child pointers
+ *          are stored. Node k on level d covers points [k * n / 2^d, (k + 1) * n / 2^d) of a single array
+ *          ordered leaf by leaf, so every subtree is one contiguous run of points. Those
+ *          points are kept as one coordinate array per axis so that a bucket can be tested against a query
+ *          radius with SIMD instructions (see radius_mask()). The tree has a depth of O(log(n / leaf_size)).
+ *          The split axis of each level, depth % K, is a template argument of the recursive helpers, so
+ *          coordinates are selected at compile time. Storing float rather than double coordinates halves
+ *          the memory traffic of both the build and queries.
+ *          Because pruning relies on the bounding boxes rather than on the splitting planes, moving points can
+ *          be refit() into the existing topology in linear time without breaking queries.
+ * \tparam T Coordinate type, typically float or double.
+ * \tparam K Number of dimensions.
+ */
+template <typename T, int K>
+class KdTree
+{
+    static_assert(K >= 1, "KdTree requires at least one dimension");
+
+public:
+    typedef T Scalar; /*!< Coordinate type. */
+    typedef KdPointTraits<T, K> Traits; /*!< Point access helpers. */
+    typedef typename Traits::Point Point; /*!< Point type stored in and accepted by this tree. */
+
+    /*!
+     * \brief KdTrees cannot be default constructed.
+     * \details KdTrees can only be constructed from a set of points.
+     */
+    KdTree() = delete;
+
+    /*!
+     * \brief Construct a balanced KdTree containing the points in \p coords.
+     * \details KdTree does not guarantee the order of the elements in \p coords will
+     *          be the same after a call to the KdTree constructor.
+     *          When \p nthreads is greater than one, the tree is built on a ThreadPool of that many workers
+     *          started for the build (see the overload taking a pool). The resulting tree is identical in shape
+     *          to a serially built tree.
+     *          A \p leaf_size of 1 yields a classic k-d tree with one point per leaf. Buckets of 8 to 64
+     *          points make the tree shallower and let radial searches scan leaves with vector instructions.
+     * \param coords A vector of unique points.
+     * \param nthreads Number of threads used to build the tree.
+     * \param leaf_size Maximum number of points stored in a leaf bucket.
+     */
+    KdTree(std::vector<Point>& coords, unsigned nthreads=1, std::size_t leaf_size=1);
+
+    /*!
+     * \brief Construct a balanced KdTree containing the points in \p coords on the workers of \p pool.
+     * \details The medians of the levels near the root, which have fewer nodes than \p pool has workers, are
+     *          each partitioned by the whole pool. The levels below are split a node per task, and the subtrees
+     *          under them are then built a subtree per task. Otherwise as the constructor taking \p nthreads.
+     * \param coords A vector of unique points.
+     * \param pool Thread pool which builds the tree. It must not be running a batch.
+     * \param leaf_size Maximum number of points stored in a leaf bucket.
+     */
+    KdTree(std::vector<Point>& coords, ThreadPool& pool, std::size_t leaf_size=1);
+
+    /*!
+     * \brief KdTree is not copy constructable.
+     */
+    KdTree(const KdTree& tree) = delete;
+
+    /*!
+     * \brief KdTree does not support move semantics.
+     */
+    KdTree(KdTree&& tree) = delete;
+
+    /*!
+     * \brief KdTree does not support assignment.
+     */
+    KdTree& operator=(const KdTree& tree) = delete;
+
+    /*!
+     * \brief Get the number of points stored in this tree.
+     */
+    std::size_t size() const { return npoints_; }
+
+    /*!
+     * \brief Print the coordinates stored in this tree using an inorder traversal pattern.
+     */
+    void print_tree() const;
+
+    /*!
+     * \brief Append every point stored in this tree to \p points, in inorder (leaf) order.
+     */
+    void get_points(std::vector<Point>& points) const;
+
+    /*!
+     * \brief Find all the neighbors of \p ref within a search radius of size \p rad.
+     * \details Subtrees whose bounding box lies farther than \p rad from \p ref are pruned, and subtrees whose
+     *          bounding box lies entirely within \p rad of \p ref are reported without any distance tests.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \param neighbors Vector used to store \p ref neighbors.
+     */
+    void radial_search(const Point& ref, T rad, std::vector<Point>& neighbors) const;
+
+    /*!
+     * \brief Find the IDs of all the neighbors of \p ref within a search radius of size \p rad.
+     * \details Reports the same neighbors in the same order as the overload above, but appends only their IDs.
+     *          A caller running many queries can clear and reuse \p neighbor_ids to avoid allocating.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \param neighbor_ids Vector to which the IDs of \p ref neighbors are appended.
+     */
+    void radial_search(const Point& ref, T rad, std::vector<unsigned int>& neighbor_ids) const;
+
+    /*!
+     * \brief Invoke \p visit with the ID of every neighbor of \p ref within a search radius of size \p rad.
+     * \details Neighbors are visited in the order radial_search() reports them, and nothing is allocated.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \param visit Callable invoked as visit(id) for each neighbor.
+     */
+    template <typename Visitor>
+    void radial_visit(const Point& ref, T rad, Visitor visit) const;
+
+    /*!
+     * \brief Count the neighbors of \p ref within a search radius of size \p rad.
+     * \details Counts exactly the points radial_search() would report without materializing any of them.
+     *          Subtrees whose bounding box lies entirely within \p rad of \p ref are counted in O(1) from the
+     *          size of their range.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \return Number of neighbors of \p ref.
+     */
+    std::size_t radial_count(const Point& ref, T rad) const;
+
+    /*!
+     * \brief Determine whether \p ref has any neighbor within a search radius of size \p rad.
+     * \details Equivalent to radial_count(ref, rad) > 0, but the search stops at the first neighbor found.
+     * \param ref A reference point.
+     * \param rad A nonnegative radius value.
+     * \return True if radial_search() would report at least one neighbor.
+     */
+    bool radial_any(const Point& ref, T rad) const;
+
+    /*!
+     * \brief Find all the neighbors of each point in \p queries within a search radius of size \p rad.
+     * \details The queries are run by collect_neighbor_lists(). The neighbors of each query are exactly those
+     *          radial_search() would report, though not necessarily in the same order. Queries scattered across
+     *          space visit unrelated parts of the tree one after another. \p reorder runs them along a Z-order
+     *          curve instead (see morton_order()), so that consecutive queries reuse the nodes and points
+     *          already in cache. Results are stored by query either way.
+     * \param queries Pointer to the first of \p nqueries reference points.
+     * \param nqueries Number of reference points.
+     * \param rad A nonnegative radius value.
+     * \param pool Thread pool which runs the queries.
+     * \param neighbors Receives the neighbor IDs of query i as list i. Previous contents are replaced.
+     * \param reorder If true, run the queries in Morton order.
+     */
+    void radial_search_batch(const Point* queries, std::size_t nqueries, T rad, ThreadPool& pool,
+            NeighborLists& neighbors, bool reorder=false) const;
+
+    /*!
+     * \brief Find every pair of points in this tree that lie within \p rad of each other.
+     * \details radial_self_join() walks the tree against itself, pairing up nodes rather than single points.
+     *          A node pair whose bounding boxes are farther apart than \p rad is pruned as a whole, and a
+     *          node pair whose bounding boxes lie entirely within \p rad of each other is accepted as a whole
+     *          without computing a single distance. Only the remaining leaf pairs are tested point by point.
+     *          As with radial_search(), points at distance zero from each other are not paired. Every pair
+     *          is reported once, as (a, b) with a < b, unless \p symmetric is set, in which case (b, a) is
+     *          reported as well.
+     * \param rad A nonnegative radius value.
+     * \param symmetric If true, report each pair in both orders.
+     * \param pairs Vector to which the ID pairs are appended in no particular order.
+     */
+    void radial_self_join(T rad, bool symmetric, std::vector<std::pair<unsigned int, unsigned int>>& pairs) const;
+
+    /*!
+     * \brief Find the \p k points closest to \p ref.
+     * \details The search keeps the best \p k candidates seen so far in a bounded max-heap. Once the heap is
+     *          full, the distance to its farthest candidate acts as a shrinking search radius which prunes
+     *          every subtree whose cell cannot hold a closer point. The nearer child of each node is visited
+     *          first so that the radius shrinks quickly. As with radial_search(), a point at distance zero
+     *          from \p ref (i.e., \p ref itself) is not reported. If the tree holds fewer than \p k other
+     *          points, all of them are reported.
+     * \param ref A reference point.
+     * \param k Number of neighbors to find.
+     * \param neighbors Vector to which the neighbors of \p ref are appended in order of increasing distance.
+     */
+    void knn_search(const Point& ref, std::size_t k, std::vector<Point>& neighbors) const;
+
+    /*!
+     * \brief Find the IDs of the \p k points closest to \p ref.
+     * \details See the overload above, which this matches except that only the IDs are appended.
+     * \param ref A reference point.
+     * \param k Number of neighbors to find.
+     * \param neighbor_ids Vector to which the neighbor IDs are appended in order of increasing distance.
+     */
+    void knn_search(const Point& ref, std::size_t k, std::vector<unsigned int>& neighbor_ids) const;
+
+    /*!
+     * \brief Move the stored points to the locations in \p coords without rebuilding the tree.
+     * \details refit() keeps the tree's topology: the point in leaf slot i is replaced by \p coords[i], slot i
+     *          being where the constructor (or the last rebuild) left that point in its \p coords. The subtree
+     *          bounds are recomputed in one O(n) pass, so queries stay exact. As points drift across the
+     *          original splits, though, sibling bounds overlap and prune less. Once overlap() exceeds
+     *          \p max_overlap, or if the number of points changed, the tree is rebuilt from \p coords, which is
+     *          then reordered just as by the constructor.
+     * \param coords Updated points, in the order the tree was last built from.
+     * \param max_overlap Largest overlap() tolerated before rebuilding.
+     * \param nthreads Number of threads used if the tree is rebuilt.
+     * \return True if the tree was rebuilt.
+     */
+    bool refit(std::vector<Point>& coords, double max_overlap=0.1, unsigned nthreads=1);
+
+    /*!
+     * \brief Get the quality metric tracked by refit(): how much sibling subtrees overlap.
+     * \details For every internal node, the overlap of its two subtrees' bounds along the split axis is
+     *          measured as a fraction of the node's extent on that axis. overlap() is the average over all
+     *          internal nodes, weighted by the number of points under each. A freshly built tree scores 0.
+     */
+    double overlap() const { return overlap_; }
+
+    /*!
+     * \brief Write this tree to \p path in the format described by KdTreeFileHeader.
+     * \details The file holds the built tree, not the input points, so open_mapped() needs no construction.
+     * \param path Path of the tree file to write.
+     * \return True if the file was written.
+     */
+    bool save(const std::string& path) const;
+
+    /*!
+     * \brief Open a tree written by save() and query it directly from a read-only memory mapping of \p path.
+     * \details Opening a tree only validates the header: nothing is copied or built, and each query reads in
+     *          just the pages it touches. The mapped pages live in the page cache, so processes which open the
+     *          same file share one copy. The file must not be modified while the tree is open. A mapped tree
+     *          supports every query, and refit() moves its points into memory.
+     * \param path Path of a tree file written by a KdTree with the same T and K.
+     * \return The mapped tree, or null if \p path cannot be mapped or is not a valid tree file.
+     */
+    static std::unique_ptr<KdTree> open_mapped(const std::string& path);
+
+    /*!
+     * \brief Build the tree of the points in the binary file \p point_file without loading them all into memory.
+     * \details The top levels of the tree are built out of core, level by level, streaming each node's points
+     *          from disk a few times. The split of each node is the median coordinate on its axis, found
+     *          exactly: a random sample brackets the median with two candidate values, a read-only pass counts
+     *          the points below, between, and above them, and the bracket is narrowed until the points between
+     *          fit in memory and can be selected from directly. A final pass then partitions the node's points
+     *          into two scratch bucket files. Once a node holds at most \p memory_points points, its whole
+     *          subtree is built in memory and written to its place in the tree file. The file is identical in
+     *          format to save()'s and matches the tree the constructor would build, up to the order of points
+     *          within a leaf and which of several points tied at a split go left. Scratch buckets take up to
+     *          about twice the size of the input next to \p tree_file. They are removed as soon as they are
+     *          consumed, or when the build fails. Only three dimensional trees of at most 2^32 - 1 points
+     *          can be built, since binary point files hold 3D points and points are given 32-bit IDs.
+     * \param point_file Binary point file (see BinaryPointHeader). As with load_binary_points(), points are
+     *        given IDs 1 through n in file order.
+     * \param tree_file Path of the tree file to write. Scratch buckets are named after it.
+     * \param memory_points Largest number of points held in memory at once. Values below 1024 are raised to 1024.
+     * \param nthreads Number of workers in the pool which builds the in-memory subtrees.
+     * \param leaf_size Maximum number of points stored in a leaf bucket.
+     * \return The tree mapped from \p tree_file (see open_mapped()), or null if the build failed.
+     */
+    static std::unique_ptr<KdTree> build_mapped(const std::string& point_file, const std::string& tree_file,
+            std::size_t memory_points, unsigned nthreads=1, std::size_t leaf_size=1);
+
+    /*!
+     * \brief Determine whether this tree is queried from a file mapped by open_mapped().
+     */
+    bool is_mapped() const { return (nullptr != mapping_); }
+
+private:
+    /*!
+     * \struct Box
+     * \brief Axis aligned bounding box of the points under a node.
+     */
+    struct Box
+    {
+        T lo_[K]; /*!< Minimum coordinate on each axis. */
+        T hi_[K]; /*!< Maximum coordinate on each axis. */
+    };
+
+    /*!
+     * \brief A knn_search() candidate as a (squared distance, point index) pair.
+     */
+    typedef std::pair<T, std::size_t> Candidate;
+
+    /*!
+     * \brief Number of arrays stored in a tree file: boxes_, left_max_, right_min_, level_width_, ids_, and coords_.
+     */
+    static const int kFileArrays = 5 + K;
+
+    /*!
+     * \brief Size of a point in a scratch bucket: its ID followed by its K coordinates, without padding.
+     */
+    static const std::size_t kBucketRecordSize = sizeof(std::uint32_t) + (K * sizeof(T));
+
+    /*!
+     * \struct PointRun
+     * \brief The points of a mapped file: either the triplets of a binary point file or scratch bucket records.
+     * \details Defined in kd_tree_file.h along with ExternalBuild.
+     */
+    struct PointRun;
+
+    /*!
+     * \struct ExternalBuild
+     * \brief State shared by the steps of a build_mapped() call.
+     */
+    struct ExternalBuild;
+
+    /*!
+     * \brief Construct the tree stored in \p mapping, which open_mapped() has validated.
+     */
+    explicit KdTree(std::unique_ptr<MappedFile> mapping);
+
+    /*!
+     * \brief Construct an empty tree with the shape of a tree of \p npoints points, to be built by build_mapped().
+     */
+    KdTree(std::size_t npoints, std::size_t leaf_size);
+
+    /*!
+     * \brief Compute the depth at which nodes are leaf buckets in a tree of \p npoints points.
+     */
+    static int leaf_depth_for(std::size_t npoints, std::size_t leaf_size)
+    {
+        int depth = 0;
+        while ((npoints >> depth) > leaf_size)
+            depth++;
+        return depth;
+    }
+
+    /*!
+     * \brief Get the coordinate of \p p on axis \p axis, chosen at run time.
+     */
+    static T coordinate(const Point& p, int axis)
+    {
+        T location[K];
+        to_array(p, location);
+        return location[axis];
+    }
+
+    /*!
+     * \brief Write \p size bytes from \p data to \p out at byte \p offset.
+     * \return True if the write succeeded.
+     */
+    static bool write_at(std::fstream& out, std::size_t offset, const void* data, std::size_t size);
+
+    /*!
+     * \brief Compute where the arrays of a tree file with \p npoints points and leaves at \p leaf_depth are stored.
+     * \param offsets Receives the byte offset of each array from the start of the file, in file order.
+     * \param sizes Receives the size of each array in bytes.
+     * \return Size of the whole file in bytes.
+     */
+    static std::size_t file_layout(std::size_t npoints, int leaf_depth, std::size_t* offsets, std::size_t* sizes);
+
+    /*!
+     * \brief Compute the squared distances from \p ref to the nearest and farthest points of \p box.
+     * \details Both are infinite for the inverted box of an empty node.
+     */
+    static void box_distances(const Box& box, const T* ref, T& min_dist_squared, T& max_dist_squared)
+    {
+        min_dist_squared = 0;
+        max_dist_squared = 0;
+        for (int axis = 0; axis < K; ++axis) {
+            T gap = std::max(T(0), std::max(box.lo_[axis] - ref[axis], ref[axis] - box.hi_[axis]));
+            T span = std::max(ref[axis] - box.lo_[axis], box.hi_[axis] - ref[axis]);
+            min_dist_squared += gap * gap;
+            max_dist_squared += span * span;
+        }
+    }
+
+    /*!
+     * \brief Copy the coordinates of \p p, starting with axis Axis, into \p out.
+     */
+    template <int Axis=0>
+    static typename std::enable_if<(Axis < K)>::type to_array(const Point& p, T* out)
+    {
+        out[Axis] = Traits::template get<Axis>(p);
+        to_array<Axis+1>(p, out);
+    }
+
+    /*!
+     * \brief End the to_array() recursion.
+     */
+    template <int Axis>
+    static typename std::enable_if<(Axis == K)>::type to_array(const Point&, T*) { }
+
+    /*!
+     * \brief Build the point stored at leaf order index \p i.
+     */
+    Point point_at(std::size_t i) const
+    {
+        T location[K];
+        for (int axis = 0; axis < K; ++axis)
+            location[axis] = coords_[axis][i];
+        return Traits::make(ids_[i], location);
+    }
+
+    /*!
+     * \brief Build the tree from \p coords, which is reordered into leaf order, on \p pool if it is not null.
+     */
+    void build(std::vector<Point>& coords, ThreadPool* pool);
+
+    /*!
+     * \brief Start a pool of \p nthreads workers to build a tree of \p npoints points.
+     * \return The pool, or null if the build is not worth running in parallel.
+     */
+    static std::unique_ptr<ThreadPool> build_pool(unsigned nthreads, std::size_t npoints)
+    {
+        if ((nthreads < 2) || (npoints < detail::kParallelBuildMin))
+            return nullptr;
+        return std::unique_ptr<ThreadPool>(new ThreadPool(nthreads));
+    }
+
+    /*!
+     * \brief Copy the leaf ordered points in \p coords into id_data_ and coord_data_ and point ids_ and coords_ at
+     *        them, releasing any mapping.
+     */
+    void load_points(const std::vector<Point>& coords);
+
+    /*!
+     * \brief Recompute the node arrays and overlap_ from the points loaded by load_points().
+     * \details boxes_, left_max_, right_min_, and level_width_ are then pointed at the owned storage.
+     */
+    void fit_bounds();
+
+    /*!
+     * \brief Compute the bounding box of every node in the subtree rooted at node \p k_root of level \p top.
+     * \param top Depth of the subtree root.
+     * \param k_root Position of the subtree root within its level.
+     * \param coords Coordinate arrays of the subtree's points, whose first elements are leaf order index \p base.
+     * \param base Leaf order index of the subtree's first point.
+     * \param box_at Callable returning a reference to the Box of the node at (depth, position within level).
+     */
+    template <typename BoxAt>
+    void compute_boxes(int top, std::size_t k_root, const T* const* coords, std::size_t base,
+            const BoxAt& box_at) const;
+
+    /*!
+     * \brief Compute the boxes of the nodes on levels [\p top, \p bottom) under node \p k_root of level \p top
+     *        from the boxes on level \p bottom.
+     * \param box_at See compute_boxes().
+     */
+    template <typename BoxAt>
+    void merge_boxes(int top, int bottom, std::size_t k_root, const BoxAt& box_at) const;
+
+    /*!
+     * \brief Derive the split axis bounds and level width of nodes [\p k_begin, \p k_end) of level \p depth.
+     * \details Also accumulates the nodes' contribution to overlap(): the overlap of their children's bounds
+     *          on the split axis, as a fraction of their extent, weighted by the number of points under them.
+     * \param box_at See compute_boxes().
+     * \param left_max Receives the children's bounds (see left_max_), from node \p k_begin on, unless \p depth is
+     *        the leaf depth.
+     * \param right_min Receives the children's bounds (see right_min_), as \p left_max.
+     * \param level_width Lowered to the smallest widest side of the nodes' nonempty boxes.
+     * \param weighted_overlap Sum of the weighted overlaps.
+     * \param weight Sum of the weights.
+     */
+    template <typename BoxAt>
+    void fit_level(int depth, std::size_t k_begin, std::size_t k_end, const BoxAt& box_at, T* left_max,
+            T* right_min, T& level_width, double& weighted_overlap, double& weight) const;
+
+    /*!
+     * \brief Find the value by which build_mapped() splits \p run on \p axis.
+     * \param run Points under the node being split.
+     * \param axis Split axis of the node.
+     * \param target Number of points which go to the left child.
+     * \param build State of the build.
+     * \param split Receives the coordinate of the point with rank \p target on \p axis.
+     * \param count_less Receives the number of points whose coordinate is less than \p split.
+     */
+    void select_split(const PointRun& run, int axis, std::size_t target, ExternalBuild& build, T& split,
+            std::size_t& count_less) const;
+
+    /*!
+     * \brief Build the subtree rooted at \p node into the tree file of a build_mapped() call.
+     * \details Nodes above top_depth_ are partitioned into scratch buckets, named after \p node's children,
+     *          which are built in turn. Nodes on top_depth_ are built in memory by write_subtree().
+     * \param bucket Scratch bucket holding the node's points, removed once they are read. Empty for the root.
+     * \param input The points of the input file, used if \p bucket is empty.
+     * \param count Number of points under \p node.
+     * \param node Index of the subtree root in breadth-first order.
+     * \param depth Depth of \p node within the tree.
+     * \param build State of the build.
+     * \return True unless writing a file failed.
+     */
+    bool build_external(const std::string& bucket, const PointRun& input, std::size_t count, std::size_t node,
+            int depth, ExternalBuild& build);
+
+    /*!
+     * \brief Build the subtree of node \p k on level top_depth_ from its \p points and write it to the tree file.
+     * \return True if the subtree was written.
+     */
+    bool write_subtree(std::vector<Point>& points, std::size_t k, ExternalBuild& build);
+
+    /*!
+     * \brief Write the levels above top_depth_, level_width_, and the header, which completes the tree file.
+     * \return True if the file was written.
+     */
+    bool finish_external(ExternalBuild& build) const;
+
+    /*!
+     * \brief Compute the index of the first point covered by node \p k on level \p depth.
+     * \param depth Level of the node within the tree.
+     * \param k Position of the node within its level.
+     * \return Index into the leaf ordered point arrays.
+     */
+    std::size_t range_begin(int depth, std::size_t k) const
+    {
+        // Ranges on a level differ in size by at most one, so the first range is (one of) the largest.
+        return detail::range_begin(npoints_, depth, k);
+    }
+
+    /*!
+     * \brief Partition \p coords[\p l, \p r) about \p median on axis Axis.
+     * \details find_median_on_axis() places the point with the median coordinate by axis at index \p median
+     *          in linear time, with no greater point before it and no lesser point after it, so that tree
+     *          construction as a whole is O(nlogn).
+     * \param l Left bound of \p coords.
+     * \param median Index of the splitting point.
+     * \param r Right bound (exclusive) of \p coords.
+     * \param coords Vector of points.
+     * \param pool Thread pool which partitions \p coords[l, r) if it is not null.
+     */
+    template <int Axis>
+    void find_median_on_axis(std::size_t l, std::size_t median, std::size_t r, std::vector<Point>& coords,
+            ThreadPool* pool);
+
+    /*!
+     * \brief Call find_median_on_axis() for \p node with the split axis of \p depth, known only at run time.
+     * \param node Index of the node in breadth-first order.
+     * \param depth Depth of \p node within the nascent tree.
+     * \param coords Vector of points.
+     * \param base Leaf order index of \p coords[0], nonzero if \p coords holds only one subtree's points.
+     * \param pool Thread pool which partitions the node's points if it is not null.
+     */
+    template <int Axis>
+    void split_node(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base, ThreadPool* pool);
+
+    /*!
+     * \brief Recursively construct the subtree rooted at \p node, which splits on axis Axis, on this thread.
+     * \details The subtree covers \p coords[range_begin(depth, k), range_begin(depth, k + 1)), where k is the
+     *          position of \p node within its level.
+     * \param node Index of the subtree root in breadth-first order.
+     * \param depth Current depth within the nascent tree.
+     * \param coords Vector of points.
+     * \param base Leaf order index of \p coords[0], nonzero if \p coords holds only one subtree's points.
+     */
+    template <int Axis>
+    void construct_tree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base);
+
+    /*!
+     * \brief Call construct_tree() with the split axis of \p depth, which is only known at run time.
+     */
+    template <int Axis>
+    void construct_subtree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base);
+
+    /*!
+     * \brief Construct the subtree rooted at \p node on \p pool, or on this thread if \p pool is null.
+     * \details The top of the subtree is split level by level. While a level has fewer nodes than \p pool has
+     *          workers, each of its medians is partitioned by the whole pool. After that, each level is one
+     *          batch with a node per task. Once there are kSubtreesPerWorker subtrees per worker, or they hold
+     *          fewer than kParallelBuildMin points, the subtrees are built as a last batch, a subtree per task.
+     *          Ranges on a level differ in size by at most one, so the tasks of a batch are balanced.
+     * \param node Index of the subtree root in breadth-first order.
+     * \param depth Depth of \p node within the nascent tree.
+     * \param coords Vector of points.
+     * \param base Leaf order index of \p coords[0], nonzero if \p coords holds only one subtree's points.
+     * \param pool Thread pool which builds the subtree, or null.
+     */
+    void build_subtree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base,
+            ThreadPool* pool);
+
+    /*!
+     * \brief Helper method used by the public radial_self_join() to pair up the points under two nodes.
+     * \param a Index of the first node (a node on the same level as \p b).
+     * \param b Index of the second node. If \p a equals \p b, the points under \p a are paired with each
+     *        other.
+     * \param depth Depth of \p a and \p b within the tree.
+     * \param rad_squared The square of a nonnegative radius value.
+     * \param symmetric If true, report each pair in both orders.
+     * \param pairs Vector used to store the ID pairs found.
+     */
+    void radial_self_join_(std::size_t a, std::size_t b, int depth, T rad_squared, bool symmetric,
+            std::vector<std::pair<unsigned int, unsigned int>>& pairs) const;
+
+    /*!
+     * \brief Helper method used by the radial searches to visit all neighbors of \p ref within \p rad.
+     * \param node Index of the subtree root in breadth-first order. The node splits on axis Axis.
+     * \param depth Depth of \p node within the tree.
+     * \param ref Coordinates of a reference point.
+     * \param rad_squared The square of a nonnegative radius value.
+     * \param visit Callable invoked with the leaf order index of every neighbor found.
+     */
+    template <int Axis, typename Visitor>
+    void radial_search_(std::size_t node, int depth, const T* ref, T rad_squared, Visitor& visit) const;
+
+    /*!
+     * \brief Helper method used by radial_count() and radial_any() to count the neighbors of \p ref.
+     * \param node Index of the subtree root in breadth-first order. The node splits on axis Axis.
+     * \param depth Depth of \p node within the tree.
+     * \param ref Coordinates of a reference point.
+     * \param rad_squared The square of a nonnegative radius value.
+     * \param limit The search may stop once it has counted this many neighbors.
+     * \return Number of neighbors under \p node, or a number no less than \p limit.
+     */
+    template <int Axis>
+    std::size_t radial_count_(std::size_t node, int depth, const T* ref, T rad_squared, std::size_t limit) const;
+
+    /*!
+     * \brief Helper method used by radial_search_() to visit every point under a node lying within the radius.
+     * \details Points are visited in the order radial_search_() would find them, without distance tests.
+     * \param node Index of the subtree root in breadth-first order. The node splits on axis Axis.
+     * \param depth Depth of \p node within the tree.
+     * \param ref Coordinates of a reference point.
+     * \param skip_coincident If true, points located exactly at \p ref are not visited.
+     * \param visit Callable invoked with the leaf order index of every point.
+     */
+    template <int Axis, typename Visitor>
+    void visit_subtree_(std::size_t node, int depth, const T* ref, bool skip_coincident, Visitor& visit) const;
+
+    /*!
+     * \brief Collect the \p k nearest neighbors of \p ref for the public knn_search() overloads.
+     * \param heap Receives the candidates, sorted by increasing distance.
+     */
+    void knn_candidates(const Point& ref, std::size_t k, std::vector<Candidate>& heap) const;
+
+    /*!
+     * \brief Helper method used by the public knn_search() to collect the \p k nearest neighbors of \p ref.
+     * \param node Index of the subtree root in breadth-first order. The node splits on axis Axis.
+     * \param depth Depth of \p node within the tree.
+     * \param ref Coordinates of a reference point.
+     * \param k Number of neighbors to find.
+     * \param offsets Per axis lower bound on the distance from \p ref to the points under \p node.
+     * \param cell_dist_squared The sum of the squares of \p offsets.
+     * \param heap Max-heap of the best candidates found so far.
+     */
+    template <int Axis>
+    void knn_search_(std::size_t node, int depth, const T* ref, std::size_t k, T* offsets,
+            T cell_dist_squared, std::vector<Candidate>& heap) const;
+
+    std::size_t npoints_; /*!< Number of points stored in this tree. */
+    std::size_t leaf_size_; /*!< Maximum number of points in a leaf bucket. */
+    int leaf_depth_; /*!< Depth at which nodes are leaf buckets. */
+    double overlap_; /*!< See overlap(). */
+    std::shared_ptr<const MappedFile> mapping_; /*!< Tree file the arrays below point into, or null if owned. */
+    std::vector<Box> box_data_; /*!< Storage for boxes_ unless the tree is mapped. */
+    std::vector<T> left_max_data_; /*!< Storage for left_max_ unless the tree is mapped. */
+    std::vector<T> right_min_data_; /*!< Storage for right_min_ unless the tree is mapped. */
+    std::vector<T> level_width_data_; /*!< Storage for level_width_ unless the tree is mapped. */
+    std::vector<unsigned int> id_data_; /*!< Storage for ids_ unless the tree is mapped. */
+    std::vector<T> coord_data_[K]; /*!< Storage for coords_ unless the tree is mapped. */
+    const Box* boxes_; /*!< Bounding box of every node in breadth-first order. Empty nodes' are inverted. */
+    const T* left_max_; /*!< boxes_ upper bound of each internal node's left child on its split axis. */
+    const T* right_min_; /*!< boxes_ lower bound of each internal node's right child on its split axis. */
+    const T* level_width_; /*!< Per level, the smallest widest side of any node's box. */
+    const unsigned int* ids_; /*!< Point IDs in leaf order. */
+    const T* coords_[K]; /*!< Point coordinates in leaf order, one array per axis. */
+}; // end KdTree
+
+template <typename T, int K>
+KdTree<T, K>::KdTree(std::vector<Point>& coords, unsigned nthreads, std::size_t leaf_size) :
+    npoints_(0), leaf_size_(std::max<std::size_t>(1, leaf_size)), leaf_depth_(0), overlap_(0)
+{
+    build(coords, build_pool(nthreads, coords.size()).get());
+}
+
+template <typename T, int K>
+KdTree<T, K>::KdTree(std::vector<Point>& coords, ThreadPool& pool, std::size_t leaf_size) :
+    npoints_(0), leaf_size_(std::max<std::size_t>(1, leaf_size)), leaf_depth_(0), overlap_(0)
+{
+    build(coords, &pool);
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::refit(std::vector<Point>& coords, double max_overlap, unsigned nthreads)
+{
+    if (coords.size() == npoints_) {
+        load_points(coords);
+        fit_bounds();
+        if (overlap_ <= max_overlap)
+            return false;
+    }
+    build(coords, build_pool(nthreads, coords.size()).get());
+    return true;
+}
+
+template <typename T, int K>
+const int KdTree<T, K>::kFileArrays;
+
+template <typename T, int K>
+const std::size_t KdTree<T, K>::kBucketRecordSize;
+
+template <typename T, int K>
+KdTree<T, K>::KdTree(std::size_t npoints, std::size_t leaf_size) :
+    npoints_(npoints), leaf_size_(std::max<std::size_t>(1, leaf_size)),
+    leaf_depth_(leaf_depth_for(npoints, leaf_size_)), overlap_(0)
+{
+}
+
+template <typename T, int K>
+void KdTree<T, K>::build(std::vector<Point>& coords, ThreadPool* pool)
+{
+    npoints_ = coords.size();
+    leaf_depth_ = leaf_depth_for(npoints_, leaf_size_);
+    build_subtree(0, 0, coords, 0, pool);
+    load_points(coords);
+    fit_bounds();
+}
+
+template <typename T, int K>
+void KdTree<T, K>::load_points(const std::vector<Point>& coords)
+{
+    mapping_.reset();
+    id_data_.resize(npoints_);
+    for (int axis = 0; axis < K; ++axis)
+        coord_data_[axis].resize(npoints_);
+    for (std::size_t i = 0; i < npoints_; ++i) {
+        T location[K];
+        to_array(coords[i], location);
+        id_data_[i] = coords[i].id_;
+        for (int axis = 0; axis < K; ++axis)
+            coord_data_[axis][i] = location[axis];
+    }
+
+    ids_ = id_data_.data();
+    for (int axis = 0; axis < K; ++axis)
+        coords_[axis] = coord_data_[axis].data();
+}
+
+template <typename T, int K>
+void KdTree<T, K>::fit_bounds()
+{
+    const std::size_t ninternal = (std::size_t(1) << leaf_depth_) - 1;
+    box_data_.resize((2 * ninternal) + 1);
+    auto box_at = [this](int depth, std::size_t k) -> Box& {
+        return box_data_[((std::size_t(1) << depth) - 1) + k];
+    };
+    compute_boxes(0, 0, coords_, 0, box_at);
+
+    left_max_data_.resize(ninternal);
+    right_min_data_.resize(ninternal);
+    level_width_data_.assign(leaf_depth_ + 1, std::numeric_limits<T>::infinity());
+    double weighted_overlap = 0;
+    double weight = 0;
+    for (int depth = 0; depth <= leaf_depth_; ++depth) {
+        std::size_t first = (std::size_t(1) << depth) - 1;
+        fit_level(depth, 0, std::size_t(1) << depth, box_at, left_max_data_.data() + first,
+                right_min_data_.data() + first, level_width_data_[depth], weighted_overlap, weight);
+    }
+    overlap_ = (weight > 0) ? (weighted_overlap / weight) : 0;
+
+    boxes_ = box_data_.data();
+    left_max_ = left_max_data_.data();
+    right_min_ = right_min_data_.data();
+    level_width_ = level_width_data_.data();
+}
+
+template <typename T, int K>
+template <typename BoxAt>
+void KdTree<T, K>::compute_boxes(int top, std::size_t k_root, const T* const* coords, std::size_t base,
+        const BoxAt& box_at) const
+{
+    const std::size_t nleaves = std::size_t(1) << (leaf_depth_ - top);
+    for (std::size_t k = k_root * nleaves; k < (k_root + 1) * nleaves; ++k) {
+        Box& box = box_at(leaf_depth_, k);
+        for (int axis = 0; axis < K; ++axis) {
+            box.lo_[axis] = std::numeric_limits<T>::infinity();
+            box.hi_[axis] = -std::numeric_limits<T>::infinity();
+        }
+        for (std::size_t i = range_begin(leaf_depth_, k); i < range_begin(leaf_depth_, k+1); ++i) {
+            for (int axis = 0; axis < K; ++axis) {
+                box.lo_[axis] = std::min(box.lo_[axis], coords[axis][i - base]);
+                box.hi_[axis] = std::max(box.hi_[axis], coords[axis][i - base]);
+            }
+        }
+    }
+    merge_boxes(top, leaf_depth_, k_root, box_at);
+}
+
+template <typename T, int K>
+template <typename BoxAt>
+void KdTree<T, K>::merge_boxes(int top, int bottom, std::size_t k_root, const BoxAt& box_at) const
+{
+    for (int depth = bottom; depth-- > top; ) {
+        const std::size_t width = std::size_t(1) << (depth - top);
+        for (std::size_t k = k_root * width; k < (k_root + 1) * width; ++k) {
+            Box& box = box_at(depth, k);
+            const Box& left = box_at(depth+1, 2 * k);
+            const Box& right = box_at(depth+1, (2 * k) + 1);
+            for (int axis = 0; axis < K; ++axis) {
+                box.lo_[axis] = std::min(left.lo_[axis], right.lo_[axis]);
+                box.hi_[axis] = std::max(left.hi_[axis], right.hi_[axis]);
+            }
+        }
+    }
+}
+
+template <typename T, int K>
+template <typename BoxAt>
+void KdTree<T, K>::fit_level(int depth, std::size_t k_begin, std::size_t k_end, const BoxAt& box_at, T* left_max,
+        T* right_min, T& level_width, double& weighted_overlap, double& weight) const
+{
+    const int axis = depth % K;
+    for (std::size_t k = k_begin; k < k_end; ++k) {
+        const Box& box = box_at(depth, k);
+        T width = 0;
+        for (int a = 0; a < K; ++a)
+            width = std::max(width, box.hi_[a] - box.lo_[a]);
+        if (box.lo_[0] <= box.hi_[0])
+            level_width = std::min(level_width, width);
+        if (depth == leaf_depth_)
+            continue;
+
+        left_max[k - k_begin] = box_at(depth+1, 2 * k).hi_[axis];
+        right_min[k - k_begin] = box_at(depth+1, (2 * k) + 1).lo_[axis];
+
+        // An empty right subtree has an infinite right_min_, so it never overlaps.
+        double extent = double(box.hi_[axis]) - double(box.lo_[axis]);
+        double overlap = double(left_max[k - k_begin]) - double(right_min[k - k_begin]);
+        double count = double(range_begin(depth, k+1) - range_begin(depth, k));
+        if (extent > 0)
+            weighted_overlap += count * std::max(0.0, overlap) / extent;
+        weight += count;
+    }
+}
+
+template <typename T, int K>
+template <int Axis>
+void KdTree<T, K>::find_median_on_axis(std::size_t l, std::size_t median, std::size_t r,
+        std::vector<Point>& coords, ThreadPool* pool)
+{
+    auto compare = [](const Point& a, const Point& b) {
+        return (Traits::template get<Axis>(a) < Traits::template get<Axis>(b));
+    };
+    auto first = coords.begin() + l;
+    auto nth = coords.begin() + median;
+    auto last = coords.begin() + r;
+    if (pool && (pool->size() > 1) && ((last - first) >= detail::kParallelPartitionMin))
+        detail::parallel_nth_element(first, nth, last, compare, *pool);
+    else
+        std::nth_element(first, nth, last, compare);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::print_tree() const
+{
+    // Leaves are stored left to right, so the leaf order is the inorder traversal.
+    for (std::size_t i = 0; i < npoints_; ++i) {
+        std::cout << "(";
+        for (int axis = 0; axis < K; ++axis)
+            std::cout << ((axis) ? ", " : "") << coords_[axis][i];
+        std::cout << ")" << std::endl;
+    }
+}
+
+template <typename T, int K>
+void KdTree<T, K>::get_points(std::vector<Point>& points) const
+{
+    points.reserve(points.size() + npoints_);
+    for (std::size_t i = 0; i < npoints_; ++i)
+        points.push_back(point_at(i));
+}
+
+template <typename T, int K>
+void KdTree<T, K>::radial_search(const Point& ref, T rad, std::vector<Point>& neighbors) const
+{
+    if (!npoints_)
+        return;
+
+    T location[K];
+    to_array(ref, location);
+    auto visit = [this, &neighbors](std::size_t i) { neighbors.push_back(point_at(i)); };
+    radial_search_<0>(0, 0, location, rad * rad, visit);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::radial_search(const Point& ref, T rad, std::vector<unsigned int>& neighbor_ids) const
+{
+    radial_visit(ref, rad, [&neighbor_ids](unsigned int id) { neighbor_ids.push_back(id); });
+}
+
+template <typename T, int K>
+template <typename Visitor>
+void KdTree<T, K>::radial_visit(const Point& ref, T rad, Visitor visit) const
+{
+    if (!npoints_)
+        return;
+
+    T location[K];
+    to_array(ref, location);
+    auto visit_index = [this, &visit](std::size_t i) { visit(ids_[i]); };
+    radial_search_<0>(0, 0, location, rad * rad, visit_index);
+}
+
+template <typename T, int K>
+std::size_t KdTree<T, K>::radial_count(const Point& ref, T rad) const
+{
+    if (!npoints_)
+        return 0;
+
+    T location[K];
+    to_array(ref, location);
+    return radial_count_<0>(0, 0, location, rad * rad, std::numeric_limits<std::size_t>::max());
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::radial_any(const Point& ref, T rad) const
+{
+    if (!npoints_)
+        return false;
+
+    T location[K];
+    to_array(ref, location);
+    return (radial_count_<0>(0, 0, location, rad * rad, 1) > 0);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::radial_search_batch(const Point* queries, std::size_t nqueries, T rad, ThreadPool& pool,
+        NeighborLists& neighbors, bool reorder) const
+{
+    const T rad_squared = rad * rad;
+    auto search = [this, rad_squared](const Point& ref, std::vector<unsigned int>& found) {
+        if (!npoints_)
+            return;
+        T location[K];
+        to_array(ref, location);
+        auto visit = [this, &found](std::size_t i) { found.push_back(ids_[i]); };
+        radial_search_<0>(0, 0, location, rad_squared, visit);
+    };
+    std::vector<std::size_t> order;
+    if (reorder)
+        morton_order<T, K>(nqueries, [queries](std::size_t i, T* out) { to_array(queries[i], out); }, order);
+    collect_neighbor_lists(queries, nqueries, pool, search, neighbors, (reorder) ? order.data() : nullptr);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::knn_search(const Point& ref, std::size_t k, std::vector<Point>& neighbors) const
+{
+    std::vector<Candidate> heap;
+    knn_candidates(ref, k, heap);
+    for (const Candidate& c : heap)
+        neighbors.push_back(point_at(c.second));
+}
+
+template <typename T, int K>
+void KdTree<T, K>::knn_search(const Point& ref, std::size_t k, std::vector<unsigned int>& neighbor_ids) const
+{
+    std::vector<Candidate> heap;
+    knn_candidates(ref, k, heap);
+    for (const Candidate& c : heap)
+        neighbor_ids.push_back(ids_[c.second]);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::knn_candidates(const Point& ref, std::size_t k, std::vector<Candidate>& heap) const
+{
+    if (!npoints_ || !k)
+        return;
+
+    T location[K];
+    to_array(ref, location);
+    heap.reserve(k);
+    T offsets[K] = {};
+    knn_search_<0>(0, 0, location, k, offsets, 0, heap);
+    std::sort_heap(heap.begin(), heap.end());
+}
+
+template <typename T, int K>
+void KdTree<T, K>::radial_self_join(T rad, bool symmetric,
+        std::vector<std::pair<unsigned int, unsigned int>>& pairs) const
+{
+    if (!npoints_)
+        return;
+
+    radial_self_join_(0, 0, 0, rad * rad, symmetric, pairs);
+}
+
+template <typename T, int K>
+template <int Axis>
+void KdTree<T, K>::split_node(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base,
+        ThreadPool* pool)
+{
+    if ((depth % K) != Axis) {
+        split_node<(Axis + 1) % K>(node, depth, coords, base, pool);
+        return;
+    }
+
+    std::size_t k = node - ((std::size_t(1) << depth) - 1);
+    std::size_t l = range_begin(depth, k);
+    std::size_t r = range_begin(depth, k+1);
+    std::size_t median = range_begin(depth+1, (2 * k) + 1);
+    if (median < r)
+        find_median_on_axis<Axis>(l - base, median - base, r - base, coords, pool);
+}
+
+template <typename T, int K>
+template <int Axis>
+void KdTree<T, K>::construct_tree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base)
+{
+    if (depth == leaf_depth_)
+        return;
+
+    split_node<Axis>(node, depth, coords, base, nullptr);
+    const int next_axis = (Axis + 1) % K;
+    construct_tree<next_axis>((2 * node) + 1, depth+1, coords, base);
+    construct_tree<next_axis>((2 * node) + 2, depth+1, coords, base);
+}
+
+template <typename T, int K>
+template <int Axis>
+void KdTree<T, K>::construct_subtree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base)
+{
+    if ((depth % K) == Axis)
+        construct_tree<Axis>(node, depth, coords, base);
+    else
+        construct_subtree<(Axis + 1) % K>(node, depth, coords, base);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::build_subtree(std::size_t node, int depth, std::vector<Point>& coords, std::size_t base,
+        ThreadPool* pool)
+{
+    const unsigned nworkers = pool ? pool->size() : 1;
+    const std::size_t k = node - ((std::size_t(1) << depth) - 1);
+    int level = depth;
+    std::size_t width = 1;
+    while ((nworkers > 1) && (level < leaf_depth_) && (width < detail::kSubtreesPerWorker * nworkers) &&
+            ((range_begin(level, (k * width) + 1) - range_begin(level, k * width)) >= detail::kParallelBuildMin)) {
+        // The nodes of a level touch disjoint ranges of coords, so they can be split concurrently.
+        const std::size_t first = ((std::size_t(1) << level) - 1) + (k * width);
+        if (width < nworkers) {
+            for (std::size_t i = 0; i < width; ++i)
+                split_node<0>(first + i, level, coords, base, pool);
+        } else {
+            pool->run(width, [&](std::size_t i, unsigned) { split_node<0>(first + i, level, coords, base, nullptr); });
+        }
+        level++;
+        width *= 2;
+    }
+
+    const std::size_t first = ((std::size_t(1) << level) - 1) + (k * width);
+    if (width > 1)
+        pool->run(width, [&](std::size_t i, unsigned) { construct_subtree<0>(first + i, level, coords, base); });
+    else
+        construct_subtree<0>(node, depth, coords, base);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::radial_self_join_(std::size_t a, std::size_t b, int depth, T rad_squared, bool symmetric,
+        std::vector<std::pair<unsigned int, unsigned int>>& pairs) const
+{
+    const Box& box_a = boxes_[a];
+    const Box& box_b = boxes_[b];
+    if ((box_a.lo_[0] > box_a.hi_[0]) || (box_b.lo_[0] > box_b.hi_[0]))
+        return;
+
+    T min_dist_squared = 0;
+    T max_dist_squared = 0;
+    for (int axis = 0; axis < K; ++axis) {
+        T gap = std::max(T(0), std::max(box_a.lo_[axis] - box_b.hi_[axis], box_b.lo_[axis] - box_a.hi_[axis]));
+        T span = std::max(box_a.hi_[axis] - box_b.lo_[axis], box_b.hi_[axis] - box_a.lo_[axis]);
+        min_dist_squared += gap * gap;
+        max_dist_squared += span * span;
+    }
+    if (min_dist_squared > rad_squared)
+        return;
+
+    auto emit = [symmetric, &pairs](unsigned int i, unsigned int j) {
+        pairs.emplace_back(std::min(i, j), std::max(i, j));
+        if (symmetric)
+            pairs.emplace_back(std::max(i, j), std::min(i, j));
+    };
+
+    std::size_t first_a = a - ((std::size_t(1) << depth) - 1);
+    std::size_t first_b = b - ((std::size_t(1) << depth) - 1);
+    std::size_t a_begin = range_begin(depth, first_a);
+    std::size_t a_end = range_begin(depth, first_a+1);
+    std::size_t b_begin = range_begin(depth, first_b);
+    std::size_t b_end = range_begin(depth, first_b+1);
+
+    if (max_dist_squared <= rad_squared) {
+        // Every pair is within the radius. Only coincident points, which can exist only if the boxes touch,
+        // need to be filtered out.
+        for (std::size_t i = a_begin; i < a_end; ++i) {
+            for (std::size_t j = (a == b) ? (i + 1) : b_begin; j < b_end; ++j) {
+                if (0 == min_dist_squared) {
+                    int axis = 0;
+                    while ((axis < K) && (coords_[axis][i] == coords_[axis][j]))
+                        ++axis;
+                    if (K == axis)
+                        continue;
+                }
+                emit(ids_[i], ids_[j]);
+            }
+        }
+        return;
+    }
+
+    if (depth == leaf_depth_) {
+        for (std::size_t i = a_begin; i < a_end; ++i) {
+            T location[K];
+            for (int axis = 0; axis < K; ++axis)
+                location[axis] = coords_[axis][i];
+            for (std::size_t j = (a == b) ? (i + 1) : b_begin; j < b_end; j += kRadiusMaskWidth) {
+                std::size_t count = std::min(kRadiusMaskWidth, b_end - j);
+                std::uint64_t mask = detail::LeafKernels<T, K>::radius_mask(coords_, j, count, location,
+                        rad_squared);
+                for (; mask; mask &= (mask - 1))
+                    emit(ids_[i], ids_[j + __builtin_ctzll(mask)]);
+            }
+        }
+        return;
+    }
+
+    if (a == b) {
+        radial_self_join_((2 * a) + 1, (2 * a) + 1, depth+1, rad_squared, symmetric, pairs);
+        radial_self_join_((2 * a) + 2, (2 * a) + 2, depth+1, rad_squared, symmetric, pairs);
+        radial_self_join_((2 * a) + 1, (2 * a) + 2, depth+1, rad_squared, symmetric, pairs);
+    } else {
+        radial_self_join_((2 * a) + 1, (2 * b) + 1, depth+1, rad_squared, symmetric, pairs);
+        radial_self_join_((2 * a) + 1, (2 * b) + 2, depth+1, rad_squared, symmetric, pairs);
+        radial_self_join_((2 * a) + 2, (2 * b) + 1, depth+1, rad_squared, symmetric, pairs);
+        radial_self_join_((2 * a) + 2, (2 * b) + 2, depth+1, rad_squared, symmetric, pairs);
+    }
+}
+
+template <typename T, int K>
+template <int Axis, typename Visitor>
+void KdTree<T, K>::radial_search_(std::size_t node, int depth, const T* ref, T rad_squared, Visitor& visit) const
+{
+    // A box can only lie within the radius if no side is longer than the diameter. Levels whose nodes are all
+    // wider than that skip the box test, which would rarely pay for itself.
+    if ((level_width_[depth] * level_width_[depth]) <= (4 * rad_squared)) {
+        T min_dist_squared;
+        T max_dist_squared;
+        box_distances(boxes_[node], ref, min_dist_squared, max_dist_squared);
+        if (min_dist_squared > rad_squared)
+            return;
+        if (max_dist_squared <= rad_squared) {
+            // Only a point coincident with ref, possible only if ref is inside the box, needs to be left out.
+            visit_subtree_<Axis>(node, depth, ref, (0 == min_dist_squared), visit);
+            return;
+        }
+    }
+
+    if (depth == leaf_depth_) {
+        std::size_t k = node - ((std::size_t(1) << depth) - 1);
+        std::size_t end = range_begin(depth, k+1);
+        for (std::size_t i = range_begin(depth, k); i < end; i += kRadiusMaskWidth) {
+            std::size_t count = std::min(kRadiusMaskWidth, end - i);
+            std::uint64_t mask = detail::LeafKernels<T, K>::radius_mask(coords_, i, count, ref, rad_squared);
+            for (; mask; mask &= (mask - 1))
+                visit(i + __builtin_ctzll(mask));
+        }
+        return;
+    }
+
+    // Descend into the children whose boxes are within the radius on this axis. The child on ref's side of the
+    // right child's lower bound, the original splitting plane, goes first.
+    T left_gap = ref[Axis] - left_max_[node];
+    T right_gap = right_min_[node] - ref[Axis];
+    std::size_t children[2] = { (2 * node) + 1, (2 * node) + 2 };
+    T gaps[2] = { left_gap, right_gap };
+    if (right_gap <= 0) {
+        std::swap(children[0], children[1]);
+        std::swap(gaps[0], gaps[1]);
+    }
+    for (int c = 0; c < 2; ++c) {
+        if ((gaps[c] <= 0) || ((gaps[c] * gaps[c]) <= rad_squared))
+            radial_search_<(Axis + 1) % K>(children[c], depth+1, ref, rad_squared, visit);
+    }
+}
+
+template <typename T, int K>
+template <int Axis>
+std::size_t KdTree<T, K>::radial_count_(std::size_t node, int depth, const T* ref, T rad_squared,
+        std::size_t limit) const
+{
+    std::size_t k = node - ((std::size_t(1) << depth) - 1);
+    if ((level_width_[depth] * level_width_[depth]) <= (4 * rad_squared)) {
+        T min_dist_squared;
+        T max_dist_squared;
+        box_distances(boxes_[node], ref, min_dist_squared, max_dist_squared);
+        if (min_dist_squared > rad_squared)
+            return 0;
+        // Unless ref lies inside the box, no point can coincide with it, so every point is a neighbor.
+        if ((max_dist_squared <= rad_squared) && (min_dist_squared > 0))
+            return (range_begin(depth, k+1) - range_begin(depth, k));
+    }
+
+    std::size_t count = 0;
+    if (depth == leaf_depth_) {
+        std::size_t end = range_begin(depth, k+1);
+        for (std::size_t i = range_begin(depth, k); (i < end) && (count < limit); i += kRadiusMaskWidth) {
+            std::size_t n = std::min(kRadiusMaskWidth, end - i);
+            count += __builtin_popcountll(detail::LeafKernels<T, K>::radius_mask(coords_, i, n, ref, rad_squared));
+        }
+        return count;
+    }
+
+    T left_gap = ref[Axis] - left_max_[node];
+    T right_gap = right_min_[node] - ref[Axis];
+    std::size_t children[2] = { (2 * node) + 1, (2 * node) + 2 };
+    T gaps[2] = { left_gap, right_gap };
+    if (right_gap <= 0) {
+        std::swap(children[0], children[1]);
+        std::swap(gaps[0], gaps[1]);
+    }
+    for (int c = 0; (c < 2) && (count < limit); ++c) {
+        if ((gaps[c] <= 0) || ((gaps[c] * gaps[c]) <= rad_squared))
+            count += radial_count_<(Axis + 1) % K>(children[c], depth+1, ref, rad_squared, limit - count);
+    }
+    return count;
+}
+
+template <typename T, int K>
+template <int Axis, typename Visitor>
+void KdTree<T, K>::visit_subtree_(std::size_t node, int depth, const T* ref, bool skip_coincident,
+        Visitor& visit) const
+{
+    if (depth == leaf_depth_) {
+        std::size_t k = node - ((std::size_t(1) << depth) - 1);
+        for (std::size_t i = range_begin(depth, k); i < range_begin(depth, k+1); ++i) {
+            if (skip_coincident) {
+                int axis = 0;
+                while ((axis < K) && (coords_[axis][i] == ref[axis]))
+                    ++axis;
+                if (K == axis)
+                    continue;
+            }
+            visit(i);
+        }
+        return;
+    }
+
+    if (right_min_[node] > ref[Axis]) {
+        visit_subtree_<(Axis + 1) % K>((2 * node) + 1, depth+1, ref, skip_coincident, visit);
+        visit_subtree_<(Axis + 1) % K>((2 * node) + 2, depth+1, ref, skip_coincident, visit);
+    } else {
+        visit_subtree_<(Axis + 1) % K>((2 * node) + 2, depth+1, ref, skip_coincident, visit);
+        visit_subtree_<(Axis + 1) % K>((2 * node) + 1, depth+1, ref, skip_coincident, visit);
+    }
+}
+
+template <typename T, int K>
+template <int Axis>
+void KdTree<T, K>::knn_search_(std::size_t node, int depth, const T* ref, std::size_t k, T* offsets,
+        T cell_dist_squared, std::vector<Candidate>& heap) const
+{
+    if (depth == leaf_depth_) {
+        std::size_t kth = node - ((std::size_t(1) << depth) - 1);
+        std::size_t end = range_begin(depth, kth+1);
+        T dist_squared[kRadiusMaskWidth];
+        for (std::size_t i = range_begin(depth, kth); i < end; i += kRadiusMaskWidth) {
+            std::size_t count = std::min(kRadiusMaskWidth, end - i);
+            detail::LeafKernels<T, K>::squared_distances(coords_, i, count, ref, dist_squared);
+            for (std::size_t j = 0; j < count; ++j) {
+                if (0 == dist_squared[j])
+                    continue;
+                if (heap.size() < k) {
+                    heap.emplace_back(dist_squared[j], i + j);
+                    std::push_heap(heap.begin(), heap.end());
+                } else if (dist_squared[j] < heap.front().first) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = Candidate(dist_squared[j], i + j);
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+        return;
+    }
+
+    // Visit the subtree whose bounds on this axis are nearer to ref first.
+    T left_gap = ref[Axis] - left_max_[node];
+    T right_gap = right_min_[node] - ref[Axis];
+    std::size_t children[2] = { (2 * node) + 1, (2 * node) + 2 };
+    T gaps[2] = { left_gap, right_gap };
+    if (right_gap < left_gap) {
+        std::swap(children[0], children[1]);
+        std::swap(gaps[0], gaps[1]);
+    }
+
+    // Each subtree's cell is at least as far as this node's, with this axis' offset raised to the subtree's gap.
+    T old_offset = offsets[Axis];
+    for (int c = 0; c < 2; ++c) {
+        T offset = std::max(old_offset, gaps[c]);
+        T child_dist_squared = cell_dist_squared - (old_offset * old_offset) + (offset * offset);
+        if ((heap.size() < k) || (child_dist_squared < heap.front().first)) {
+            offsets[Axis] = offset;
+            knn_search_<(Axis + 1) % K>(children[c], depth+1, ref, k, offsets, child_dist_squared, heap);
+            offsets[Axis] = old_offset;
+        }
+    }
+}
+
+} // end nnalgo
@@ -0,0 +1,622 @@
+/*!
+ * \file kd_tree_file.h
+ * \brief Define the KdTree members which save trees to files and map them back: save(), open_mapped(), and
+ *        build_mapped().
+ * \details Only callers which save or map trees include this header, so the file and mapping code stays out
+ *          of kd_tree.h.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include "kd_tree.h"
+#include "point_io.h"
+#include "mapped_file.h"
+
+namespace nnalgo
+{
+
+namespace detail
+{
+
+/*!
+ * \brief Magic number at the start of a KdTree file.
+ */
+const char kTreeFileMagic[4] = {'N', 'N', 'K', 'D'};
+
+/*!
+ * \brief Version of the KdTree file format written by KdTree::save().
+ */
+const std::uint32_t kTreeFileVersion = 1;
+
+/*!
+ * \brief Every array in a KdTree file starts at a multiple of this many bytes.
+ */
+const std::size_t kTreeFileAlignment = 64;
+
+/*!
+ * \brief Number of coordinates sampled to choose each split of an out-of-core build.
+ */
+const std::size_t kExternalSampleSize = 1024;
+
+/*!
+ * \brief Number of points buffered per scratch bucket before they are written out.
+ */
+const std::size_t kBucketWriteSize = 1 << 14;
+
+/*!
+ * \class ScratchFiles
+ * \brief Paths of scratch files which are removed when the object goes out of scope, even if a step failed.
+ */
+class ScratchFiles
+{
+public:
+    ScratchFiles() = default;
+    ScratchFiles(const ScratchFiles&) = delete;
+    ScratchFiles& operator=(const ScratchFiles&) = delete;
+
+    ~ScratchFiles()
+    {
+        for (const std::string& path : paths_)
+            std::remove(path.c_str());
+    }
+
+    /*!
+     * \brief Remove \p path along with the other scratch files. Missing files are ignored.
+     */
+    void add(const std::string& path) { paths_.push_back(path); }
+
+private:
+    std::vector<std::string> paths_;
+};
+
+} // end detail
+
+/*!
+ * \struct KdTreeFileHeader
+ * \brief Header at the start of a file written by KdTree::save().
+ * \details The header is followed by the tree's arrays exactly as they are laid out in memory: the node boxes,
+ *          each K minimum then K maximum coordinates, the left child upper bounds, the right child lower bounds,
+ *          the level widths, the point IDs, and then one coordinate array per axis. Each array starts at the
+ *          next multiple of 64 bytes from the start of the file and the gaps are zero filled. Arrays are
+ *          located by their offsets alone, so the file can be mapped at any address. All fields are stored in
+ *          native byte order.
+ */
+struct KdTreeFileHeader
+{
+    char magic_[4]; /*!< Always "NNKD". */
+    std::uint32_t version_; /*!< Format version, currently 1. */
+    std::uint32_t scalar_size_; /*!< Size of each coordinate in bytes. */
+    std::uint32_t dimensions_; /*!< Number of dimensions, K. */
+    std::uint64_t count_; /*!< Number of points in the tree. */
+    std::uint64_t leaf_size_; /*!< Maximum number of points in a leaf bucket. */
+    std::uint32_t leaf_depth_; /*!< Depth at which nodes are leaf buckets. */
+    std::uint32_t reserved_; /*!< Must be zero. */
+    double overlap_; /*!< See KdTree::overlap(). */
+};
+
+/*!
+ * \struct PointRun
+ * \brief The points of a mapped file: either the triplets of a binary point file or scratch bucket records.
+ */
+template <typename T, int K>
+struct KdTree<T, K>::PointRun
+{
+    const char* data_; /*!< First point. */
+    std::size_t count_; /*!< Number of points. */
+    std::uint32_t scalar_size_; /*!< Coordinate size of a binary point file, or 0 for bucket records. */
+
+    /*!
+     * \brief Read point \p i. The points of a binary point file get ID \p i + 1.
+     */
+    Point operator[](std::size_t i) const
+    {
+        T location[K] = {};
+        if (0 == scalar_size_) {
+            const char* record = data_ + (i * kBucketRecordSize);
+            std::uint32_t id;
+            std::memcpy(&id, record, sizeof(id));
+            std::memcpy(location, record + sizeof(id), sizeof(location));
+            return Traits::make(id, location);
+        }
+        for (int axis = 0; (axis < K) && (axis < 3); ++axis) {
+            if (sizeof(float) == scalar_size_) {
+                float value;
+                std::memcpy(&value, data_ + (((3 * i) + axis) * sizeof(value)), sizeof(value));
+                location[axis] = value;
+            } else {
+                double value;
+                std::memcpy(&value, data_ + (((3 * i) + axis) * sizeof(value)), sizeof(value));
+                location[axis] = value;
+            }
+        }
+        return Traits::make(static_cast<unsigned int>(i + 1), location);
+    }
+};
+
+/*!
+ * \struct ExternalBuild
+ * \brief State shared by the steps of a build_mapped() call.
+ */
+template <typename T, int K>
+struct KdTree<T, K>::ExternalBuild
+{
+    std::string tree_file_; /*!< Path of the tree file being written. */
+    std::fstream out_; /*!< The tree file. */
+    std::size_t offsets_[kFileArrays]; /*!< Offset of each array within the tree file. */
+    std::size_t memory_points_; /*!< Largest number of points held in memory at once. */
+    ThreadPool* pool_; /*!< Workers which build each in-memory subtree, or null to build them serially. */
+    int top_depth_; /*!< Depth of the subtrees built in memory. */
+    std::vector<Box> top_boxes_; /*!< Boxes of the nodes above and on top_depth_ in breadth-first order. */
+    std::vector<T> level_width_; /*!< level_width_ of the tree being written. */
+    double weighted_overlap_; /*!< Weighted overlap accumulated so far (see fit_level()). */
+    double weight_; /*!< Weight accumulated so far (see fit_level()). */
+    std::mt19937 gen_; /*!< Chooses the sampled points. */
+};
+
+template <typename T, int K>
+KdTree<T, K>::KdTree(std::unique_ptr<MappedFile> mapping) : mapping_(std::move(mapping))
+{
+    KdTreeFileHeader header;
+    std::memcpy(&header, mapping_->data(), sizeof(header));
+    npoints_ = header.count_;
+    leaf_size_ = header.leaf_size_;
+    leaf_depth_ = header.leaf_depth_;
+    overlap_ = header.overlap_;
+
+    std::size_t offsets[kFileArrays];
+    std::size_t sizes[kFileArrays];
+    file_layout(npoints_, leaf_depth_, offsets, sizes);
+    const char* base = mapping_->data();
+    boxes_ = reinterpret_cast<const Box*>(base + offsets[0]);
+    left_max_ = reinterpret_cast<const T*>(base + offsets[1]);
+    right_min_ = reinterpret_cast<const T*>(base + offsets[2]);
+    level_width_ = reinterpret_cast<const T*>(base + offsets[3]);
+    ids_ = reinterpret_cast<const unsigned int*>(base + offsets[4]);
+    for (int axis = 0; axis < K; ++axis)
+        coords_[axis] = reinterpret_cast<const T*>(base + offsets[5 + axis]);
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::write_at(std::fstream& out, std::size_t offset, const void* data, std::size_t size)
+{
+    out.seekp(offset);
+    out.write(static_cast<const char*>(data), size);
+    return static_cast<bool>(out);
+}
+
+template <typename T, int K>
+std::size_t KdTree<T, K>::file_layout(std::size_t npoints, int leaf_depth, std::size_t* offsets,
+        std::size_t* sizes)
+{
+    const std::size_t nleaves = std::size_t(1) << leaf_depth;
+    sizes[0] = ((2 * nleaves) - 1) * sizeof(Box);
+    sizes[1] = (nleaves - 1) * sizeof(T);
+    sizes[2] = (nleaves - 1) * sizeof(T);
+    sizes[3] = (leaf_depth + 1) * sizeof(T);
+    sizes[4] = npoints * sizeof(unsigned int);
+    for (int axis = 0; axis < K; ++axis)
+        sizes[5 + axis] = npoints * sizeof(T);
+
+    std::size_t end = sizeof(KdTreeFileHeader);
+    for (int a = 0; a < kFileArrays; ++a) {
+        offsets[a] = ((end + detail::kTreeFileAlignment - 1) / detail::kTreeFileAlignment) *
+                detail::kTreeFileAlignment;
+        end = offsets[a] + sizes[a];
+    }
+    return end;
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::save(const std::string& path) const
+{
+    KdTreeFileHeader header;
+    std::memcpy(header.magic_, detail::kTreeFileMagic, sizeof(detail::kTreeFileMagic));
+    header.version_ = detail::kTreeFileVersion;
+    header.scalar_size_ = sizeof(T);
+    header.dimensions_ = K;
+    header.count_ = npoints_;
+    header.leaf_size_ = leaf_size_;
+    header.leaf_depth_ = leaf_depth_;
+    header.reserved_ = 0;
+    header.overlap_ = overlap_;
+
+    std::size_t offsets[kFileArrays];
+    std::size_t sizes[kFileArrays];
+    file_layout(npoints_, leaf_depth_, offsets, sizes);
+    const void* arrays[kFileArrays] = { boxes_, left_max_, right_min_, level_width_, ids_ };
+    for (int axis = 0; axis < K; ++axis)
+        arrays[5 + axis] = coords_[axis];
+
+    const char padding[detail::kTreeFileAlignment] = {};
+    std::ofstream tree_file_handle(path, std::ios::binary | std::ios::trunc);
+    tree_file_handle.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::size_t written = sizeof(header);
+    for (int a = 0; a < kFileArrays; ++a) {
+        tree_file_handle.write(padding, offsets[a] - written);
+        tree_file_handle.write(static_cast<const char*>(arrays[a]), sizes[a]);
+        written = offsets[a] + sizes[a];
+    }
+    if (!tree_file_handle) {
+        std::cerr << "Unable to write file: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+template <typename T, int K>
+std::unique_ptr<KdTree<T, K>> KdTree<T, K>::open_mapped(const std::string& path)
+{
+    std::unique_ptr<MappedFile> mapping(new MappedFile);
+    if (!mapping->open(path, false)) {
+        std::cerr << "Unable to open file: " << path << std::endl;
+        std::cerr << "Check that you provided a valid path." << std::endl;
+        return nullptr;
+    }
+
+    KdTreeFileHeader header;
+    if (mapping->size() < sizeof(header)) {
+        std::cerr << "Truncated tree file header: " << path << std::endl;
+        return nullptr;
+    }
+    std::memcpy(&header, mapping->data(), sizeof(header));
+    if ((0 != std::memcmp(header.magic_, detail::kTreeFileMagic, sizeof(detail::kTreeFileMagic))) ||
+            (detail::kTreeFileVersion != header.version_) || (sizeof(T) != header.scalar_size_) ||
+            (K != header.dimensions_)) {
+        std::cerr << "Unsupported tree file: " << path << std::endl;
+        return nullptr;
+    }
+
+    // The leaf depth follows from the point count and leaf size, so recomputing it catches a corrupt header
+    // before the array sizes are derived from it.
+    bool valid = (header.leaf_size_ > 0) && (header.count_ <= mapping->size());
+    if (valid) {
+        const std::size_t npoints = header.count_;
+        const int leaf_depth = leaf_depth_for(npoints, header.leaf_size_);
+        std::size_t offsets[kFileArrays];
+        std::size_t sizes[kFileArrays];
+        valid = (int(header.leaf_depth_) == leaf_depth) &&
+                (file_layout(npoints, leaf_depth, offsets, sizes) <= mapping->size());
+    }
+    if (!valid) {
+        std::cerr << "Corrupt tree file: " << path << std::endl;
+        return nullptr;
+    }
+
+    return std::unique_ptr<KdTree>(new KdTree(std::move(mapping)));
+}
+
+template <typename T, int K>
+std::unique_ptr<KdTree<T, K>> KdTree<T, K>::build_mapped(const std::string& point_file,
+        const std::string& tree_file, std::size_t memory_points, unsigned nthreads, std::size_t leaf_size)
+{
+    if (3 != K) {
+        std::cerr << "Binary point files hold three dimensional points." << std::endl;
+        return nullptr;
+    }
+    MappedFile input;
+    BinaryPointHeader header;
+    if (!map_binary_points(point_file, input, header))
+        return nullptr;
+
+    KdTree shell(header.count_, leaf_size);
+    const std::unique_ptr<ThreadPool> pool = build_pool(nthreads, header.count_);
+    ExternalBuild build;
+    build.tree_file_ = tree_file;
+    build.memory_points_ = std::max(memory_points, detail::kExternalSampleSize);
+    build.pool_ = pool.get();
+    build.top_depth_ = 0;
+    const std::size_t npoints = shell.npoints_;
+    while ((build.top_depth_ < shell.leaf_depth_) &&
+            (((npoints + (std::size_t(1) << build.top_depth_) - 1) >> build.top_depth_) > build.memory_points_))
+        build.top_depth_++;
+    build.top_boxes_.resize((std::size_t(2) << build.top_depth_) - 1);
+    build.level_width_.assign(shell.leaf_depth_ + 1, std::numeric_limits<T>::infinity());
+    build.weighted_overlap_ = 0;
+    build.weight_ = 0;
+    std::size_t sizes[kFileArrays];
+    file_layout(npoints, shell.leaf_depth_, build.offsets_, sizes);
+
+    build.out_.open(tree_file, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    const PointRun points = { input.data() + sizeof(header), npoints, header.scalar_size_ };
+    bool written = build.out_ && shell.build_external(std::string(), points, npoints, 0, 0, build) &&
+            shell.finish_external(build);
+    build.out_.close();
+    if (!written) {
+        std::cerr << "Unable to write file: " << tree_file << std::endl;
+        std::remove(tree_file.c_str());
+        return nullptr;
+    }
+
+    return open_mapped(tree_file);
+}
+
+template <typename T, int K>
+void KdTree<T, K>::select_split(const PointRun& run, int axis, std::size_t target, ExternalBuild& build,
+        T& split, std::size_t& count_less) const
+{
+    if (target >= run.count_) {
+        split = std::numeric_limits<T>::infinity();
+        count_less = run.count_;
+        return;
+    }
+
+    // The point of rank target lies in [lo, hi], which holds count points and has below points before it.
+    const std::size_t margin = detail::kExternalSampleSize / 32;
+    T lo = -std::numeric_limits<T>::infinity();
+    T hi = std::numeric_limits<T>::infinity();
+    std::size_t below = 0;
+    std::size_t count = run.count_;
+    std::vector<T> sample;
+    std::uniform_int_distribution<std::size_t> pick(0, run.count_ - 1);
+    for (std::size_t s = 0; s < std::min(detail::kExternalSampleSize, count); ++s)
+        sample.push_back(coordinate(run[pick(build.gen_)], axis));
+
+    std::vector<T> samples[3];
+    std::vector<T> values;
+    bool narrow = true;
+    for (;;) {
+        // Bracket the target rank with two sampled values. If the last bracket did not shrink the range, which
+        // heavy ties can cause, split around a single value instead, removing at least its ties.
+        T pivots[2] = { lo, hi };
+        if (count > build.memory_points_) {
+            std::sort(sample.begin(), sample.end());
+            std::size_t r = std::min(sample.size() - 1, ((target - below) * sample.size()) / count);
+            pivots[0] = sample[(narrow) ? ((r > margin) ? (r - margin) : 0) : r];
+            pivots[1] = sample[(narrow) ? std::min(sample.size() - 1, r + margin) : r];
+        }
+
+        // Count the points below, between, and above the pivots, sampling each part and keeping the values
+        // between the pivots while they fit in memory.
+        std::size_t counts[3] = { 0, 0, 0 };
+        for (std::vector<T>& part_sample : samples)
+            part_sample.clear();
+        values.clear();
+        for (std::size_t i = 0; i < run.count_; ++i) {
+            T value = coordinate(run[i], axis);
+            if (!(value >= lo) || !(value <= hi))
+                continue;
+            int part = (value < pivots[0]) ? 0 : ((value > pivots[1]) ? 2 : 1);
+            if ((1 == part) && (counts[1] < build.memory_points_))
+                values.push_back(value);
+            if (counts[part] < detail::kExternalSampleSize) {
+                samples[part].push_back(value);
+            } else {
+                std::size_t slot = std::uniform_int_distribution<std::size_t>(0, counts[part])(build.gen_);
+                if (slot < detail::kExternalSampleSize)
+                    samples[part][slot] = value;
+            }
+            counts[part]++;
+        }
+
+        if (target < (below + counts[0])) {
+            hi = std::nextafter(pivots[0], -std::numeric_limits<T>::infinity());
+            count = counts[0];
+            sample.swap(samples[0]);
+            narrow = true;
+        } else if (target >= (below + counts[0] + counts[1])) {
+            lo = std::nextafter(pivots[1], std::numeric_limits<T>::infinity());
+            below += counts[0] + counts[1];
+            count = counts[2];
+            sample.swap(samples[2]);
+            narrow = true;
+        } else {
+            below += counts[0];
+            if (pivots[0] == pivots[1]) {
+                split = pivots[0];
+                count_less = below;
+                return;
+            }
+            if (counts[1] <= build.memory_points_) {
+                auto nth = values.begin() + (target - below);
+                std::nth_element(values.begin(), nth, values.end());
+                split = *nth;
+                count_less = below + std::count_if(values.begin(), values.end(), [split](T v) { return (v < split); });
+                return;
+            }
+            narrow = (counts[1] < count);
+            lo = pivots[0];
+            hi = pivots[1];
+            count = counts[1];
+            sample.swap(samples[1]);
+        }
+    }
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::build_external(const std::string& bucket, const PointRun& input, std::size_t count,
+        std::size_t node, int depth, ExternalBuild& build)
+{
+    const std::size_t k = node - ((std::size_t(1) << depth) - 1);
+    const std::size_t left_count = range_begin(depth+1, (2 * k) + 1) - range_begin(depth, k);
+    std::string children[2];
+
+    // This node's bucket and its children's are removed on every return, including failures partway through.
+    detail::ScratchFiles scratch;
+    if (!bucket.empty())
+        scratch.add(bucket);
+    {
+        MappedFile file;
+        PointRun run = input;
+        if (!bucket.empty()) {
+            run = { nullptr, count, 0 };
+            if (count && !file.open(bucket, true))
+                return false;
+            run.data_ = file.data();
+        }
+
+        if (depth == build.top_depth_) {
+            std::vector<Point> points(count);
+            for (std::size_t i = 0; i < count; ++i)
+                points[i] = run[i];
+            if (!bucket.empty())
+                std::remove(bucket.c_str());
+            return write_subtree(points, k, build);
+        }
+
+        const int axis = depth % K;
+        T split;
+        std::size_t count_less;
+        select_split(run, axis, left_count, build, split, count_less);
+
+        // Points tied with the split go left until the left child is full.
+        std::size_t equal_left = left_count - count_less;
+        std::ofstream files[2];
+        std::vector<char> buffers[2];
+        for (int c = 0; c < 2; ++c) {
+            children[c] = build.tree_file_ + ".bucket" + std::to_string((2 * node) + 1 + c);
+            scratch.add(children[c]);
+            files[c].open(children[c], std::ios::binary | std::ios::trunc);
+            buffers[c].reserve(detail::kBucketWriteSize * kBucketRecordSize);
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            Point p = run[i];
+            T value = coordinate(p, axis);
+            int c = (value < split) ? 0 : 1;
+            if ((value == split) && equal_left) {
+                c = 0;
+                equal_left--;
+            }
+
+            // Only the ID and coordinates are written, so padding bytes of Point never reach the disk.
+            char record[kBucketRecordSize];
+            std::uint32_t id = p.id_;
+            T location[K];
+            to_array(p, location);
+            std::memcpy(record, &id, sizeof(id));
+            std::memcpy(record + sizeof(id), location, sizeof(location));
+            buffers[c].insert(buffers[c].end(), record, record + kBucketRecordSize);
+            if (buffers[c].size() == (detail::kBucketWriteSize * kBucketRecordSize)) {
+                if (!files[c].write(buffers[c].data(), buffers[c].size()))
+                    return false;
+                buffers[c].clear();
+            }
+        }
+        for (int c = 0; c < 2; ++c) {
+            files[c].write(buffers[c].data(), buffers[c].size());
+            files[c].close();
+            if (!files[c])
+                return false;
+        }
+    }
+    if (!bucket.empty())
+        std::remove(bucket.c_str());
+
+    return build_external(children[0], input, left_count, (2 * node) + 1, depth+1, build) &&
+            build_external(children[1], input, count - left_count, (2 * node) + 2, depth+1, build);
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::write_subtree(std::vector<Point>& points, std::size_t k, ExternalBuild& build)
+{
+    const int top = build.top_depth_;
+    const std::size_t base = range_begin(top, k);
+    const std::size_t count = points.size();
+    build_subtree(((std::size_t(1) << top) - 1) + k, top, points, base, build.pool_);
+
+    std::vector<unsigned int> ids(count);
+    std::vector<T> coords[K];
+    const T* coord_arrays[K];
+    for (int axis = 0; axis < K; ++axis) {
+        coords[axis].resize(count);
+        coord_arrays[axis] = coords[axis].data();
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        T location[K];
+        to_array(points[i], location);
+        ids[i] = points[i].id_;
+        for (int axis = 0; axis < K; ++axis)
+            coords[axis][i] = location[axis];
+    }
+    std::vector<Point>().swap(points);
+
+    // The subtree's boxes are kept in its own breadth-first order, so each of its levels is one contiguous run
+    // of its level in the tree file.
+    std::vector<Box> boxes((std::size_t(2) << (leaf_depth_ - top)) - 1);
+    auto box_at = [&boxes, top, k](int depth, std::size_t position) -> Box& {
+        const int level = depth - top;
+        return boxes[((std::size_t(1) << level) - 1) + (position - (k << level))];
+    };
+    compute_boxes(top, k, coord_arrays, base, box_at);
+    build.top_boxes_[((std::size_t(1) << top) - 1) + k] = box_at(top, k);
+
+    bool written = write_at(build.out_, build.offsets_[4] + (base * sizeof(unsigned int)), ids.data(),
+            count * sizeof(unsigned int));
+    for (int axis = 0; axis < K; ++axis)
+        written = written && write_at(build.out_, build.offsets_[5 + axis] + (base * sizeof(T)), coords[axis].data(),
+                count * sizeof(T));
+
+    std::vector<T> left_max;
+    std::vector<T> right_min;
+    for (int depth = top; depth <= leaf_depth_; ++depth) {
+        const std::size_t width = std::size_t(1) << (depth - top);
+        const std::size_t node = ((std::size_t(1) << depth) - 1) + (k * width);
+        left_max.resize(width);
+        right_min.resize(width);
+        fit_level(depth, k * width, (k + 1) * width, box_at, left_max.data(), right_min.data(),
+                build.level_width_[depth], build.weighted_overlap_, build.weight_);
+        written = written && write_at(build.out_, build.offsets_[0] + (node * sizeof(Box)), &box_at(depth, k * width),
+                width * sizeof(Box));
+        if (depth < leaf_depth_) {
+            written = written && write_at(build.out_, build.offsets_[1] + (node * sizeof(T)), left_max.data(),
+                    width * sizeof(T));
+            written = written && write_at(build.out_, build.offsets_[2] + (node * sizeof(T)), right_min.data(),
+                    width * sizeof(T));
+        }
+    }
+    return written;
+}
+
+template <typename T, int K>
+bool KdTree<T, K>::finish_external(ExternalBuild& build) const
+{
+    const int top = build.top_depth_;
+    const std::size_t ntop = (std::size_t(1) << top) - 1;
+    auto box_at = [&build](int depth, std::size_t k) -> Box& {
+        return build.top_boxes_[((std::size_t(1) << depth) - 1) + k];
+    };
+    merge_boxes(0, top, 0, box_at);
+
+    std::vector<T> left_max(ntop);
+    std::vector<T> right_min(ntop);
+    for (int depth = 0; depth < top; ++depth) {
+        std::size_t first = (std::size_t(1) << depth) - 1;
+        fit_level(depth, 0, std::size_t(1) << depth, box_at, left_max.data() + first, right_min.data() + first,
+                build.level_width_[depth], build.weighted_overlap_, build.weight_);
+    }
+
+    KdTreeFileHeader header;
+    std::memcpy(header.magic_, detail::kTreeFileMagic, sizeof(detail::kTreeFileMagic));
+    header.version_ = detail::kTreeFileVersion;
+    header.scalar_size_ = sizeof(T);
+    header.dimensions_ = K;
+    header.count_ = npoints_;
+    header.leaf_size_ = leaf_size_;
+    header.leaf_depth_ = leaf_depth_;
+    header.reserved_ = 0;
+    header.overlap_ = (build.weight_ > 0) ? (build.weighted_overlap_ / build.weight_) : 0;
+
+    // The header goes last, so that a build which fails partway never leaves a file open_mapped() accepts.
+    std::size_t offsets[kFileArrays];
+    std::size_t sizes[kFileArrays];
+    file_layout(npoints_, leaf_depth_, offsets, sizes);
+    return write_at(build.out_, offsets[0], build.top_boxes_.data(), ntop * sizeof(Box)) &&
+            write_at(build.out_, offsets[1], left_max.data(), ntop * sizeof(T)) &&
+            write_at(build.out_, offsets[2], right_min.data(), ntop * sizeof(T)) &&
+            write_at(build.out_, offsets[3], build.level_width_.data(), sizes[3]) &&
+            write_at(build.out_, 0, &header, sizeof(header));
+}
+
+} // end nnalgo
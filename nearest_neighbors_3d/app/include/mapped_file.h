@@ -0,0 +1,44 @@
+/*!
+ * \file mapped_file.h
+ * \brief Declare the MappedFile class.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace nnalgo
+{
+
+/*!
+ * \class MappedFile
+ * \brief Read-only memory mapping of a whole file, unmapped on destruction.
+ * \details The mapping is backed by the page cache, so processes mapping the same file share its pages.
+ */
+class MappedFile
+{
+public:
+    MappedFile() : data_(nullptr), size_(0) { }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    /*!
+     * \brief Map \p path into memory.
+     * \param path Path of the file to map.
+     * \param sequential If true, the file will be read front to back, so the kernel may read ahead
+     *        aggressively. Otherwise accesses are expected to be scattered and only the touched pages are read.
+     * \return True if the file is mapped. Empty files cannot be mapped.
+     */
+    bool open(const std::string& path, bool sequential);
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_;
+    std::size_t size_;
+};
+
+} // end nnalgo
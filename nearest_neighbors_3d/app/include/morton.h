@@ -0,0 +1,116 @@
+/*!
+ * \file morton.h
+ * \brief Declare the Morton (Z-order) helpers which order the batched queries of the trees and the grid.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+namespace nnalgo
+{
+
+/*!
+ * \class MortonEncoder
+ * \brief Map K-dimensional locations to their position along a Z-order curve through a bounding box.
+ * \details Each coordinate is quantized to kBitsPerAxis bits within the box, and the bits of all axes are
+ *          interleaved from the most significant down, axis 0 first. Points that are close together along the
+ *          curve are close together in space, so queries sorted by code (see morton_order()) and run in that
+ *          order by collect_neighbor_lists() visit the same nodes and cells as the queries just before them,
+ *          which are still cached.
+ */
+template <typename T, int K>
+class MortonEncoder
+{
+public:
+    /*!
+     * \brief Number of bits each coordinate is quantized to, so that a code fits in 64 bits.
+     */
+    static const int kBitsPerAxis = ((64 / K) > 32) ? 32 : (64 / K);
+
+    /*!
+     * \brief Construct an encoder for the box with corners \p lo and \p hi.
+     */
+    MortonEncoder(const T* lo, const T* hi)
+    {
+        const double ncells = double((std::uint64_t(1) << kBitsPerAxis) - 1);
+        for (int axis = 0; axis < K; ++axis) {
+            lo_[axis] = lo[axis];
+            scale_[axis] = (hi[axis] > lo[axis]) ? (ncells / (double(hi[axis]) - double(lo[axis]))) : 0.0;
+        }
+    }
+
+    /*!
+     * \brief Compute the code of \p location. Locations outside the box are clamped to it.
+     */
+    std::uint64_t operator()(const T* location) const
+    {
+        const std::uint64_t max_cell = (std::uint64_t(1) << kBitsPerAxis) - 1;
+        std::uint64_t cells[K];
+        for (int axis = 0; axis < K; ++axis) {
+            double cell = (double(location[axis]) - double(lo_[axis])) * scale_[axis];
+            cells[axis] = (cell > 0) ? std::min(max_cell, static_cast<std::uint64_t>(cell)) : 0;
+        }
+
+        std::uint64_t code = 0;
+        for (int bit = kBitsPerAxis; bit-- > 0; ) {
+            for (int axis = 0; axis < K; ++axis)
+                code = (code << 1) | ((cells[axis] >> bit) & 1);
+        }
+        return code;
+    }
+
+private:
+    T lo_[K]; /*!< Minimum corner of the box. */
+    double scale_[K]; /*!< Cells per unit length on each axis. */
+};
+
+template <typename T, int K>
+const int MortonEncoder<T, K>::kBitsPerAxis;
+
+/*!
+ * \brief Compute the order in which to visit \p npoints points so that they follow a Z-order curve.
+ * \details The curve runs through the bounding box of the points, so the order adapts to where they lie.
+ * \param npoints Number of points.
+ * \param location Callable invoked as location(i, out) to write the coordinates of point i to out[0, K).
+ * \param order Receives the point indices sorted by Morton code. Previous contents are replaced.
+ */
+template <typename T, int K, typename Location>
+void morton_order(std::size_t npoints, const Location& location, std::vector<std::size_t>& order)
+{
+    order.clear();
+    if (!npoints)
+        return;
+
+    T lo[K];
+    T hi[K];
+    location(0, lo);
+    location(0, hi);
+    for (std::size_t i = 1; i < npoints; ++i) {
+        T p[K];
+        location(i, p);
+        for (int axis = 0; axis < K; ++axis) {
+            lo[axis] = std::min(lo[axis], p[axis]);
+            hi[axis] = std::max(hi[axis], p[axis]);
+        }
+    }
+
+    MortonEncoder<T, K> encode(lo, hi);
+    std::vector<std::pair<std::uint64_t, std::size_t>> keys(npoints);
+    for (std::size_t i = 0; i < npoints; ++i) {
+        T p[K];
+        location(i, p);
+        keys[i] = std::make_pair(encode(p), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    order.resize(npoints);
+    for (std::size_t i = 0; i < npoints; ++i)
+        order[i] = keys[i].second;
+}
+
+} // end nnalgo
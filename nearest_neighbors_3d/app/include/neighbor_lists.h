@@ -0,0 +1,118 @@
+/*!
+ * \file neighbor_lists.h
+ * \brief Declare the compressed sparse row result type shared by the batched neighbor searches.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace nnalgo
+{
+
+/*!
+ * \struct NeighborLists
+ * \brief Declare a compact, compressed sparse row store for the neighbors of a batch of query points.
+ * \details The neighbors of query i are ids_[offsets_[i]] through ids_[offsets_[i+1] - 1]. Memory use is
+ *          proportional to the number of neighbors found rather than to the square of the batch size.
+ */
+struct NeighborLists
+{
+    std::vector<std::size_t> offsets_; /*!< Start of each query's neighbors in ids_, plus one past the end. */
+    std::vector<unsigned int> ids_; /*!< Neighbor IDs of all queries, query by query. */
+
+    /*!
+     * \brief Get the number of queries stored.
+     */
+    std::size_t size() const { return (offsets_.empty()) ? 0 : (offsets_.size() - 1); }
+
+    /*!
+     * \brief Get the number of neighbors of query \p i.
+     */
+    std::size_t count(std::size_t i) const { return (offsets_[i+1] - offsets_[i]); }
+
+    /*!
+     * \brief Get a pointer to the first neighbor ID of query \p i.
+     */
+    const unsigned int* begin(std::size_t i) const { return (ids_.data() + offsets_[i]); }
+
+    /*!
+     * \brief Get a pointer one past the last neighbor ID of query \p i.
+     */
+    const unsigned int* end(std::size_t i) const { return (ids_.data() + offsets_[i+1]); }
+};
+
+/*!
+ * \brief Number of queries per task in a batched search.
+ */
+const std::size_t kBatchChunkSize = 256;
+
+/*!
+ * \brief Run a batch of neighbor queries on \p pool and gather the results into \p neighbors.
+ * \details The queries are split into chunks of kBatchChunkSize which the workers of \p pool claim
+ *          dynamically. Each worker collects neighbor IDs in its own scratch buffer, which is reused from one
+ *          chunk to the next, and the chunks are finally stitched together in query order. If \p order is
+ *          given, the queries are run in that order instead, typically one in which consecutive queries lie
+ *          close together (see morton_order()), and their results are scattered back to their own lists.
+ * \param queries Pointer to the first of \p nqueries reference points.
+ * \param nqueries Number of reference points.
+ * \param pool Thread pool which runs the queries.
+ * \param search Callable invoked as search(query, found) which appends the neighbor IDs of query to the
+ *        std::vector<unsigned int> found.
+ * \param neighbors Receives the neighbor IDs of query i as list i. Previous contents are replaced.
+ * \param order Optional permutation of [0, \p nqueries) giving the order in which the queries are run.
+ */
+template <typename Query, typename Search>
+void collect_neighbor_lists(const Query* queries, std::size_t nqueries, ThreadPool& pool, const Search& search,
+        NeighborLists& neighbors, const std::size_t* order=nullptr)
+{
+    const std::size_t nchunks = (nqueries + kBatchChunkSize - 1) / kBatchChunkSize;
+
+    neighbors.offsets_.assign(nqueries + 1, 0);
+    neighbors.ids_.clear();
+
+    // Neighbor counts land in offsets_[i+1] and are turned into offsets once all chunks finish.
+    std::vector<std::vector<unsigned int>> chunk_ids(nchunks);
+    std::vector<std::vector<unsigned int>> scratch(pool.size());
+    pool.run(nchunks, [&](std::size_t chunk, unsigned worker) {
+        std::vector<unsigned int>& found = scratch[worker];
+        found.clear();
+
+        std::size_t end = std::min(nqueries, (chunk + 1) * kBatchChunkSize);
+        for (std::size_t j = chunk * kBatchChunkSize; j < end; ++j) {
+            std::size_t q = (order) ? order[j] : j;
+            std::size_t before = found.size();
+            search(queries[q], found);
+            neighbors.offsets_[q+1] = found.size() - before;
+        }
+        chunk_ids[chunk].assign(found.begin(), found.end());
+    });
+
+    std::vector<std::size_t> chunk_offsets(nchunks + 1, 0);
+    for (std::size_t c = 0; c < nchunks; ++c)
+        chunk_offsets[c+1] = chunk_offsets[c] + chunk_ids[c].size();
+    for (std::size_t q = 0; q < nqueries; ++q)
+        neighbors.offsets_[q+1] += neighbors.offsets_[q];
+
+    neighbors.ids_.resize(chunk_offsets[nchunks]);
+    pool.run(nchunks, [&](std::size_t chunk, unsigned) {
+        if (order) {
+            const unsigned int* src = chunk_ids[chunk].data();
+            std::size_t end = std::min(nqueries, (chunk + 1) * kBatchChunkSize);
+            for (std::size_t j = chunk * kBatchChunkSize; j < end; ++j) {
+                std::size_t q = order[j];
+                std::copy(src, src + neighbors.count(q), neighbors.ids_.begin() + neighbors.offsets_[q]);
+                src += neighbors.count(q);
+            }
+        } else {
+            std::copy(chunk_ids[chunk].begin(), chunk_ids[chunk].end(),
+                    neighbors.ids_.begin() + chunk_offsets[chunk]);
+        }
+        std::vector<unsigned int>().swap(chunk_ids[chunk]);
+    });
+}
+
+} // end nnalgo
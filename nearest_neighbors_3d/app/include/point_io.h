@@ -0,0 +1,87 @@
+/*!
+ * \file point_io.h
+ * \brief Declare fast loaders for text and binary point files.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "kd_point.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace nnalgo
+{
+
+/*!
+ * \struct BinaryPointHeader
+ * \brief Header at the start of a binary point file.
+ * \details A binary point file holds the header followed by count_ packed (x, y, z) triplets of either
+ *          float or double values. All fields are stored in native byte order. Because the payload needs no
+ *          parsing, the file is memory-mapped and converted to points directly. Points get 32-bit IDs, so
+ *          loaders accept at most 2^32 - 1 of them.
+ */
+struct BinaryPointHeader
+{
+    char magic_[4]; /*!< Always "NN3D". */
+    std::uint32_t version_; /*!< Format version, currently 1. */
+    std::uint32_t scalar_size_; /*!< Size of each coordinate in bytes: 4 for float or 8 for double. */
+    std::uint32_t reserved_; /*!< Must be zero. */
+    std::uint64_t count_; /*!< Number of points in the file. */
+};
+
+/*!
+ * \brief Determine whether \p point_file starts with a binary point file header.
+ * \param point_file Path to a point data file.
+ * \return True if the file can be opened and begins with the binary magic.
+ */
+bool is_binary_point_file(const std::string& point_file);
+
+/*!
+ * \brief Load the 3D points in the text file \p point_file into \p points.
+ * \details The file holds the number of points followed by one "x y z" line per point. It is memory-mapped
+ *          and split into chunks at line boundaries which the workers of \p pool parse concurrently. Points
+ *          are given IDs 1 through n in file order.
+ * \param point_file Path to the 3D point data file.
+ * \param pool Thread pool which parses the file.
+ * \param points Vector of ingested 3D points. Previous contents are replaced.
+ * \return True if all points are loaded from the input file.
+ */
+bool load_text_points(const std::string& point_file, ThreadPool& pool, std::vector<ThreeDPoint>& points);
+
+/*!
+ * \brief Load the 3D points in the binary file \p point_file into \p points.
+ * \details The file is memory-mapped and its triplets are copied out by the workers of \p pool. Points are
+ *          given IDs 1 through n in file order.
+ * \param point_file Path to the binary point file.
+ * \param pool Thread pool which converts the file.
+ * \param points Vector of ingested 3D points. Previous contents are replaced.
+ * \return True if all points are loaded from the input file.
+ */
+bool load_binary_points(const std::string& point_file, ThreadPool& pool, std::vector<ThreeDPoint>& points);
+
+/*!
+ * \brief Map the binary file \p point_file into \p file and validate its header.
+ * \details The triplets start at file.data() + sizeof(BinaryPointHeader). Streaming them from the mapping lets
+ *          callers process files larger than memory.
+ * \param point_file Path to the binary point file.
+ * \param file Receives the mapping.
+ * \param header Receives a copy of the file's header.
+ * \return True if the file is mapped and holds as many points as its header declares. Files declaring more than
+ *         2^32 - 1 points are rejected, since points are given 32-bit IDs 1 through n.
+ */
+bool map_binary_points(const std::string& point_file, MappedFile& file, BinaryPointHeader& header);
+
+/*!
+ * \brief Save \p points in ID order to the binary file \p point_file.
+ * \param point_file Path of the binary point file to write.
+ * \param points Points with IDs 1 through n, in any order.
+ * \param single_precision If true, store coordinates as float rather than double.
+ * \return True if the file was written.
+ */
+bool save_binary_points(const std::string& point_file, const std::vector<ThreeDPoint>& points,
+        bool single_precision);
+
+} // end nnalgo
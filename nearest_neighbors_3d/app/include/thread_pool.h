@@ -0,0 +1,100 @@
+/*!
+ * \file thread_pool.h
+ * \brief Declare a minimal fork-join thread pool.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+namespace nnalgo
+{
+
+/*!
+ * \class ThreadPool
+ * \brief A fixed set of worker threads which cooperatively run batches of tasks.
+ * \details The workers are started once and sleep between batches, so submitting a batch costs a wakeup
+ *          rather than a thread creation. Tasks within a batch are handed out dynamically, one index at a
+ *          time, which balances batches whose tasks vary in cost. The thread calling run() takes part in
+ *          the batch as worker 0.
+ */
+class ThreadPool
+{
+public:
+    /*!
+     * \brief Task signature. The first argument is the task index and the second the worker index.
+     */
+    typedef std::function<void(std::size_t, unsigned)> Task;
+
+    /*!
+     * \brief ThreadPools cannot be default constructed.
+     */
+    ThreadPool() = delete;
+
+    /*!
+     * \brief Start a pool of \p nthreads workers including the calling thread.
+     * \param nthreads Number of workers. Values less than one are treated as one.
+     */
+    explicit ThreadPool(unsigned nthreads);
+
+    /*!
+     * \brief ThreadPool is not copy constructable.
+     */
+    ThreadPool(const ThreadPool& pool) = delete;
+
+    /*!
+     * \brief ThreadPool does not support assignment.
+     */
+    ThreadPool& operator=(const ThreadPool& pool) = delete;
+
+    /*!
+     * \brief Stop and join all workers.
+     */
+    ~ThreadPool();
+
+    /*!
+     * \brief Get the number of workers in this pool.
+     * \return The number of workers including the thread calling run().
+     */
+    unsigned size() const { return static_cast<unsigned>(workers_.size()) + 1; }
+
+    /*!
+     * \brief Run \p task(i, worker) for every i in [0, \p ntasks) and wait for all of them to finish.
+     * \details run() is not reentrant: \p task must not call run() on the same pool.
+     * \param ntasks Number of tasks in the batch.
+     * \param task Callable invoked once per task index.
+     */
+    void run(std::size_t ntasks, const Task& task);
+
+private:
+    /*!
+     * \brief Worker thread main loop.
+     * \param worker Index of this worker.
+     */
+    void work(unsigned worker);
+
+    /*!
+     * \brief Execute tasks from the current batch until none remain.
+     * \param worker Index of the executing worker.
+     */
+    void drain(unsigned worker);
+
+    std::vector<std::thread> workers_; /*!< Workers 1 through size() - 1. */
+    std::mutex mutex_; /*!< Guards the batch state below. */
+    std::condition_variable start_; /*!< Signaled when a batch is posted or the pool stops. */
+    std::condition_variable done_; /*!< Signaled when the last worker leaves a batch. */
+    const Task* task_; /*!< Task of the current batch. */
+    std::size_t ntasks_; /*!< Number of tasks in the current batch. */
+    std::atomic<std::size_t> next_task_; /*!< Next unclaimed task index. */
+    unsigned long generation_; /*!< Incremented for every posted batch. */
+    unsigned active_; /*!< Workers still executing the current batch. */
+    bool stop_; /*!< True when the pool is being destroyed. */
+}; // end ThreadPool
+
+} // end nnalgo
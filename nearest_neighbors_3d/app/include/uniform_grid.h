@@ -0,0 +1,131 @@
+/*!
+ * \file uniform_grid.h
+ * \brief Declare the UniformGrid3D container class.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include "kd_point.h"
+#include "neighbor_lists.h"
+
+namespace nnalgo
+{
+
+/*!
+ * \class UniformGrid3D
+ * \brief Declare a uniform grid index for fixed-radius neighbor searches in 3D space.
+ * \details UniformGrid3D splits the bounding box of its points into cubic cells and buckets every point by
+ *          cell. With the cell size equal to the search radius, a radial query only has to scan the 27 cells
+ *          around the reference point, and the index is built in O(n) time. This makes the grid a better fit
+ *          than ThreeDTree for fixed-radius jobs on evenly spread points. Its interface mirrors ThreeDTree's.
+ *          Points are counting sorted by cell into separate x, y, and z arrays, cells in x-major order, so
+ *          that a run of cells along the x-axis is one contiguous block scanned with radius_mask().
+ *          To bound memory use on sparse inputs, the cell size is grown when the requested size would give
+ *          more than eight cells per point.
+ */
+class UniformGrid3D
+{
+public:
+    /*!
+     * \brief UniformGrid3Ds cannot be default constructed.
+     */
+    UniformGrid3D() = delete;
+
+    /*!
+     * \brief Construct a UniformGrid3D containing the points in \p coords.
+     * \param coords A vector of unique ThreeDPoint objects. Unlike ThreeDTree, the grid leaves it unchanged.
+     * \param cell_size Edge length of a grid cell. Typically the search radius.
+     */
+    UniformGrid3D(const std::vector<ThreeDPoint>& coords, double cell_size);
+
+    /*!
+     * \brief UniformGrid3D is not copy constructable.
+     */
+    UniformGrid3D(const UniformGrid3D& grid) = delete;
+
+    /*!
+     * \brief UniformGrid3D does not support assignment.
+     */
+    UniformGrid3D& operator=(const UniformGrid3D& grid) = delete;
+
+    /*!
+     * \brief Find all the neighbors of \p ref within a search radius of size \p rad.
+     * \details As with ThreeDTree::radial_search(), a point at distance zero from \p ref is not reported. Any
+     *          radius is accepted, but radii larger than the cell size scan more than 27 cells.
+     * \param ref A 3D reference point.
+     * \param rad A nonnegative radius value.
+     * \param neighbors Vector used to store \p ref neighbors.
+     */
+    void radial_search(const ThreeDPoint& ref, double rad, std::vector<ThreeDPoint>& neighbors) const;
+
+    /*!
+     * \brief Find the IDs of all the neighbors of \p ref within a search radius of size \p rad.
+     * \details See ThreeDTree::radial_search(). Only the IDs are appended, so \p neighbor_ids can be reused.
+     * \param ref A 3D reference point.
+     * \param rad A nonnegative radius value.
+     * \param neighbor_ids Vector to which the IDs of \p ref neighbors are appended.
+     */
+    void radial_search(const ThreeDPoint& ref, double rad, std::vector<unsigned int>& neighbor_ids) const;
+
+    /*!
+     * \brief Find all the neighbors of each point in \p queries within a search radius of size \p rad.
+     * \details See ThreeDTree::radial_search_batch().
+     * \param queries Pointer to the first of \p nqueries 3D reference points.
+     * \param nqueries Number of reference points.
+     * \param rad A nonnegative radius value.
+     * \param pool Thread pool which runs the queries.
+     * \param neighbors Receives the neighbor IDs of query i as list i. Previous contents are replaced.
+     * \param reorder If true, run the queries in Morton order so that consecutive queries scan nearby cells.
+     */
+    void radial_search_batch(const ThreeDPoint* queries, std::size_t nqueries, double rad, ThreadPool& pool,
+            NeighborLists& neighbors, bool reorder=false) const;
+
+    /*!
+     * \brief Find every pair of points in this grid that lie within \p rad of each other.
+     * \details Every cell is paired with itself and with only the half of its neighbor cells that come after
+     *          it in storage order, so each pair of cells, and thus each pair of points, is visited once.
+     *          Output follows ThreeDTree::radial_self_join().
+     * \param rad A nonnegative radius value.
+     * \param symmetric If true, report each pair in both orders.
+     * \param pairs Vector to which the ID pairs are appended in no particular order.
+     */
+    void radial_self_join(double rad, bool symmetric,
+            std::vector<std::pair<unsigned int, unsigned int>>& pairs) const;
+
+private:
+    /*!
+     * \brief Compute the cell coordinate of \p value on \p axis, clamped to the grid.
+     * \param value A coordinate.
+     * \param axis Axis of \p value (0, 1, or 2 for x, y, or z).
+     * \return Cell coordinate in [0, dims_[axis]).
+     */
+    long cell_of(double value, int axis) const;
+
+    /*!
+     * \brief Compute the storage index of cell (\p x, \p y, \p z).
+     */
+    std::size_t cell_index(long x, long y, long z) const { return ((z * dims_[1]) + y) * dims_[0] + x; }
+
+    /*!
+     * \brief Helper method used by the radial searches to visit all neighbors of \p ref within \p rad.
+     * \param ref A 3D reference point.
+     * \param rad A nonnegative radius value.
+     * \param visit Callable invoked with the storage index of every neighbor found.
+     */
+    template <typename Visitor>
+    void radial_search_(const ThreeDPoint& ref, double rad, Visitor& visit) const;
+
+    double origin_[3]; /*!< Minimum corner of the grid. */
+    double cell_size_; /*!< Edge length of a cell. */
+    long dims_[3]; /*!< Number of cells along each axis. */
+    std::vector<std::size_t> cell_start_; /*!< Start of each cell's points, plus one past the end. */
+    std::vector<unsigned int> ids_; /*!< Point IDs in cell order. */
+    std::vector<double> xs_; /*!< Point x coordinates in cell order. */
+    std::vector<double> ys_; /*!< Point y coordinates in cell order. */
+    std::vector<double> zs_; /*!< Point z coordinates in cell order. */
+}; // end UniformGrid3D
+
+} // end nnalgo
@@ -0,0 +1,87 @@
+/*!
+ * \file verlet_lists.h
+ * \brief Declare the VerletLists class.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include "kd_point.h"
+#include "thread_pool.h"
+#include "neighbor_lists.h"
+
+namespace nnalgo
+{
+
+/*!
+ * \class VerletLists
+ * \brief Declare Verlet neighbor lists, which track the neighbors of a set of slowly moving points.
+ * \details Rather than rebuilding a ThreeDTree and rerunning every radial search after each time step,
+ *          VerletLists finds the candidate neighbors of every point within the enlarged radius rad + skin
+ *          once. Each update() then only filters those candidates by the true radius, a linear scan. While
+ *          no point has moved more than skin / 2 since the candidates were found, no two points can have
+ *          closed the skin, so the filtered lists are exact. Once some point moves further, the candidates
+ *          are found anew. A larger skin means fewer rebuilds but longer candidate lists to filter.
+ */
+class VerletLists
+{
+public:
+    /*!
+     * \brief VerletLists cannot be default constructed.
+     */
+    VerletLists() = delete;
+
+    /*!
+     * \brief Construct empty VerletLists. The first update() finds the candidate neighbors.
+     * \param rad A nonnegative search radius.
+     * \param skin A nonnegative distance added to \p rad when finding candidates.
+     */
+    VerletLists(double rad, double skin);
+
+    /*!
+     * \brief VerletLists is not copy constructable.
+     */
+    VerletLists(const VerletLists& lists) = delete;
+
+    /*!
+     * \brief VerletLists does not support assignment.
+     */
+    VerletLists& operator=(const VerletLists& lists) = delete;
+
+    /*!
+     * \brief Recompute the neighbors of every point in \p points at their current positions.
+     * \details Point i must be the same point from one call to the next. The candidates are found anew if the
+     *          number of points changed or if some point moved more than skin / 2 since they were last found.
+     *          As with ThreeDTree::radial_search(), a point at distance zero from point i is not its neighbor.
+     * \param points Current positions of the points.
+     * \param pool Thread pool which filters the candidate lists.
+     * \return True if the candidates were found anew.
+     */
+    bool update(const std::vector<ThreeDPoint>& points, ThreadPool& pool);
+
+    /*!
+     * \brief Get the neighbor IDs of every point as of the last update(). List i belongs to point i.
+     */
+    const NeighborLists& neighbors() const { return neighbors_; }
+
+    /*!
+     * \brief Get the number of times the candidates have been found.
+     */
+    std::size_t rebuild_count() const { return rebuilds_; }
+
+private:
+    /*!
+     * \brief Find the candidate neighbors of every point in \p points within rad_ + skin_.
+     */
+    void rebuild(const std::vector<ThreeDPoint>& points);
+
+    double rad_; /*!< Search radius. */
+    double skin_; /*!< Extra distance covered by the candidate lists. */
+    std::size_t rebuilds_; /*!< Number of calls to rebuild(). */
+    std::vector<ThreeDPoint> reference_; /*!< Positions of the points when the candidates were found. */
+    NeighborLists candidates_; /*!< Indices of the points within rad_ + skin_ of each point, at reference_. */
+    NeighborLists neighbors_; /*!< IDs of the points within rad_ of each point. */
+};
+
+} // end nnalgo
@@ -0,0 +1,364 @@
+/*!
+ * \file distance_kernels.cc
+ * \brief Distance kernel definitions.
+ */
+
+#include "distance_kernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NN_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace nnalgo
+{
+
+namespace
+{
+
+/*!
+ * \brief Signature shared by all radius_mask() implementations.
+ */
+typedef std::uint64_t (*RadiusMaskKernel)(const double*, const double*, const double*, std::size_t,
+        double, double, double, double);
+
+/*!
+ * \brief Signature shared by all squared_distances() implementations.
+ */
+typedef void (*SquaredDistancesKernel)(const double*, const double*, const double*, std::size_t,
+        double, double, double, double*);
+
+/*!
+ * \brief Signature shared by all single precision radius_mask() implementations.
+ */
+typedef std::uint64_t (*RadiusMaskKernelF)(const float*, const float*, const float*, std::size_t,
+        float, float, float, float);
+
+/*!
+ * \brief Signature shared by all single precision squared_distances() implementations.
+ */
+typedef void (*SquaredDistancesKernelF)(const float*, const float*, const float*, std::size_t,
+        float, float, float, float*);
+
+/*!
+ * \brief Scalar radius_mask() for either precision.
+ */
+template <typename T>
+std::uint64_t radius_mask_generic(const T* xs, const T* ys, const T* zs, std::size_t n,
+        T qx, T qy, T qz, T rad_squared)
+{
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        T x_term = xs[i] - qx;
+        T y_term = ys[i] - qy;
+        T z_term = zs[i] - qz;
+        T dist_squared = (x_term * x_term) + (y_term * y_term) + (z_term * z_term);
+        if ((dist_squared <= rad_squared) && (0 != dist_squared))
+            mask |= (std::uint64_t(1) << i);
+    }
+    return mask;
+}
+
+/*!
+ * \brief Scalar squared_distances() for either precision.
+ */
+template <typename T>
+void squared_distances_generic(const T* xs, const T* ys, const T* zs, std::size_t n,
+        T qx, T qy, T qz, T* dist_squared)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        T x_term = xs[i] - qx;
+        T y_term = ys[i] - qy;
+        T z_term = zs[i] - qz;
+        dist_squared[i] = (x_term * x_term) + (y_term * y_term) + (z_term * z_term);
+    }
+}
+
+std::uint64_t radius_mask_scalar(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double rad_squared)
+{
+    return radius_mask_generic(xs, ys, zs, n, qx, qy, qz, rad_squared);
+}
+
+void squared_distances_scalar(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double* dist_squared)
+{
+    squared_distances_generic(xs, ys, zs, n, qx, qy, qz, dist_squared);
+}
+
+std::uint64_t radius_mask_scalar_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float rad_squared)
+{
+    return radius_mask_generic(xs, ys, zs, n, qx, qy, qz, rad_squared);
+}
+
+void squared_distances_scalar_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float* dist_squared)
+{
+    squared_distances_generic(xs, ys, zs, n, qx, qy, qz, dist_squared);
+}
+
+#ifdef NN_X86_DISPATCH
+__attribute__((target("avx2")))
+std::uint64_t radius_mask_avx2(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double rad_squared)
+{
+    const __m256d vqx = _mm256_set1_pd(qx);
+    const __m256d vqy = _mm256_set1_pd(qy);
+    const __m256d vqz = _mm256_set1_pd(qz);
+    const __m256d vrad = _mm256_set1_pd(rad_squared);
+    const __m256d zero = _mm256_setzero_pd();
+
+    std::uint64_t mask = 0;
+    std::size_t i = 0;
+    for (; (i + 4) <= n; i += 4) {
+        __m256d x_term = _mm256_sub_pd(_mm256_loadu_pd(xs + i), vqx);
+        __m256d y_term = _mm256_sub_pd(_mm256_loadu_pd(ys + i), vqy);
+        __m256d z_term = _mm256_sub_pd(_mm256_loadu_pd(zs + i), vqz);
+        __m256d dist_squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x_term, x_term),
+                    _mm256_mul_pd(y_term, y_term)), _mm256_mul_pd(z_term, z_term));
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(dist_squared, vrad, _CMP_LE_OQ),
+                _mm256_cmp_pd(dist_squared, zero, _CMP_NEQ_OQ));
+        mask |= std::uint64_t(_mm256_movemask_pd(inside)) << i;
+    }
+    if (i < n)
+        mask |= radius_mask_scalar(xs + i, ys + i, zs + i, n - i, qx, qy, qz, rad_squared) << i;
+
+    return mask;
+}
+
+__attribute__((target("avx512f")))
+std::uint64_t radius_mask_avx512(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double rad_squared)
+{
+    const __m512d vqx = _mm512_set1_pd(qx);
+    const __m512d vqy = _mm512_set1_pd(qy);
+    const __m512d vqz = _mm512_set1_pd(qz);
+    const __m512d vrad = _mm512_set1_pd(rad_squared);
+    const __m512d zero = _mm512_setzero_pd();
+
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < n; i += 8) {
+        // Lanes past the end of the block are masked off on load and in the result.
+        __mmask8 lanes = (n - i >= 8) ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+        __m512d x_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, xs + i), vqx);
+        __m512d y_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, ys + i), vqy);
+        __m512d z_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, zs + i), vqz);
+        __m512d dist_squared = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(x_term, x_term),
+                    _mm512_mul_pd(y_term, y_term)), _mm512_mul_pd(z_term, z_term));
+        __mmask8 inside = _mm512_mask_cmp_pd_mask(lanes, dist_squared, vrad, _CMP_LE_OQ) &
+            _mm512_cmp_pd_mask(dist_squared, zero, _CMP_NEQ_OQ);
+        mask |= std::uint64_t(inside) << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2")))
+void squared_distances_avx2(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double* dist_squared)
+{
+    const __m256d vqx = _mm256_set1_pd(qx);
+    const __m256d vqy = _mm256_set1_pd(qy);
+    const __m256d vqz = _mm256_set1_pd(qz);
+
+    std::size_t i = 0;
+    for (; (i + 4) <= n; i += 4) {
+        __m256d x_term = _mm256_sub_pd(_mm256_loadu_pd(xs + i), vqx);
+        __m256d y_term = _mm256_sub_pd(_mm256_loadu_pd(ys + i), vqy);
+        __m256d z_term = _mm256_sub_pd(_mm256_loadu_pd(zs + i), vqz);
+        _mm256_storeu_pd(dist_squared + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x_term, x_term),
+                        _mm256_mul_pd(y_term, y_term)), _mm256_mul_pd(z_term, z_term)));
+    }
+    squared_distances_scalar(xs + i, ys + i, zs + i, n - i, qx, qy, qz, dist_squared + i);
+}
+
+__attribute__((target("avx512f")))
+void squared_distances_avx512(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double* dist_squared)
+{
+    const __m512d vqx = _mm512_set1_pd(qx);
+    const __m512d vqy = _mm512_set1_pd(qy);
+    const __m512d vqz = _mm512_set1_pd(qz);
+
+    for (std::size_t i = 0; i < n; i += 8) {
+        __mmask8 lanes = (n - i >= 8) ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+        __m512d x_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, xs + i), vqx);
+        __m512d y_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, ys + i), vqy);
+        __m512d z_term = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, zs + i), vqz);
+        _mm512_mask_storeu_pd(dist_squared + i, lanes, _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(x_term, x_term),
+                        _mm512_mul_pd(y_term, y_term)), _mm512_mul_pd(z_term, z_term)));
+    }
+}
+
+__attribute__((target("avx2")))
+std::uint64_t radius_mask_avx2_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float rad_squared)
+{
+    const __m256 vqx = _mm256_set1_ps(qx);
+    const __m256 vqy = _mm256_set1_ps(qy);
+    const __m256 vqz = _mm256_set1_ps(qz);
+    const __m256 vrad = _mm256_set1_ps(rad_squared);
+    const __m256 zero = _mm256_setzero_ps();
+
+    std::uint64_t mask = 0;
+    std::size_t i = 0;
+    for (; (i + 8) <= n; i += 8) {
+        __m256 x_term = _mm256_sub_ps(_mm256_loadu_ps(xs + i), vqx);
+        __m256 y_term = _mm256_sub_ps(_mm256_loadu_ps(ys + i), vqy);
+        __m256 z_term = _mm256_sub_ps(_mm256_loadu_ps(zs + i), vqz);
+        __m256 dist_squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x_term, x_term),
+                    _mm256_mul_ps(y_term, y_term)), _mm256_mul_ps(z_term, z_term));
+        __m256 inside = _mm256_and_ps(_mm256_cmp_ps(dist_squared, vrad, _CMP_LE_OQ),
+                _mm256_cmp_ps(dist_squared, zero, _CMP_NEQ_OQ));
+        mask |= std::uint64_t(_mm256_movemask_ps(inside)) << i;
+    }
+    if (i < n)
+        mask |= radius_mask_scalar_f(xs + i, ys + i, zs + i, n - i, qx, qy, qz, rad_squared) << i;
+
+    return mask;
+}
+
+__attribute__((target("avx2")))
+void squared_distances_avx2_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float* dist_squared)
+{
+    const __m256 vqx = _mm256_set1_ps(qx);
+    const __m256 vqy = _mm256_set1_ps(qy);
+    const __m256 vqz = _mm256_set1_ps(qz);
+
+    std::size_t i = 0;
+    for (; (i + 8) <= n; i += 8) {
+        __m256 x_term = _mm256_sub_ps(_mm256_loadu_ps(xs + i), vqx);
+        __m256 y_term = _mm256_sub_ps(_mm256_loadu_ps(ys + i), vqy);
+        __m256 z_term = _mm256_sub_ps(_mm256_loadu_ps(zs + i), vqz);
+        _mm256_storeu_ps(dist_squared + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x_term, x_term),
+                        _mm256_mul_ps(y_term, y_term)), _mm256_mul_ps(z_term, z_term)));
+    }
+    squared_distances_scalar_f(xs + i, ys + i, zs + i, n - i, qx, qy, qz, dist_squared + i);
+}
+
+__attribute__((target("avx512f")))
+std::uint64_t radius_mask_avx512_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float rad_squared)
+{
+    const __m512 vqx = _mm512_set1_ps(qx);
+    const __m512 vqy = _mm512_set1_ps(qy);
+    const __m512 vqz = _mm512_set1_ps(qz);
+    const __m512 vrad = _mm512_set1_ps(rad_squared);
+    const __m512 zero = _mm512_setzero_ps();
+
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < n; i += 16) {
+        __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+        __m512 x_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, xs + i), vqx);
+        __m512 y_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, ys + i), vqy);
+        __m512 z_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, zs + i), vqz);
+        __m512 dist_squared = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x_term, x_term),
+                    _mm512_mul_ps(y_term, y_term)), _mm512_mul_ps(z_term, z_term));
+        __mmask16 inside = _mm512_mask_cmp_ps_mask(lanes, dist_squared, vrad, _CMP_LE_OQ) &
+            _mm512_cmp_ps_mask(dist_squared, zero, _CMP_NEQ_OQ);
+        mask |= std::uint64_t(inside) << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx512f")))
+void squared_distances_avx512_f(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float* dist_squared)
+{
+    const __m512 vqx = _mm512_set1_ps(qx);
+    const __m512 vqy = _mm512_set1_ps(qy);
+    const __m512 vqz = _mm512_set1_ps(qz);
+
+    for (std::size_t i = 0; i < n; i += 16) {
+        __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+        __m512 x_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, xs + i), vqx);
+        __m512 y_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, ys + i), vqy);
+        __m512 z_term = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, zs + i), vqz);
+        _mm512_mask_storeu_ps(dist_squared + i, lanes, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x_term, x_term),
+                        _mm512_mul_ps(y_term, y_term)), _mm512_mul_ps(z_term, z_term)));
+    }
+}
+#endif
+
+RadiusMaskKernel select_radius_mask()
+{
+#ifdef NN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return radius_mask_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return radius_mask_avx2;
+#endif
+    return radius_mask_scalar;
+}
+
+SquaredDistancesKernel select_squared_distances()
+{
+#ifdef NN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return squared_distances_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return squared_distances_avx2;
+#endif
+    return squared_distances_scalar;
+}
+
+RadiusMaskKernelF select_radius_mask_f()
+{
+#ifdef NN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return radius_mask_avx512_f;
+    if (__builtin_cpu_supports("avx2"))
+        return radius_mask_avx2_f;
+#endif
+    return radius_mask_scalar_f;
+}
+
+SquaredDistancesKernelF select_squared_distances_f()
+{
+#ifdef NN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return squared_distances_avx512_f;
+    if (__builtin_cpu_supports("avx2"))
+        return squared_distances_avx2_f;
+#endif
+    return squared_distances_scalar_f;
+}
+
+} // end anonymous namespace
+
+std::uint64_t radius_mask(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double rad_squared)
+{
+    static const RadiusMaskKernel kernel = select_radius_mask();
+    return kernel(xs, ys, zs, n, qx, qy, qz, rad_squared);
+}
+
+void squared_distances(const double* xs, const double* ys, const double* zs, std::size_t n,
+        double qx, double qy, double qz, double* dist_squared)
+{
+    static const SquaredDistancesKernel kernel = select_squared_distances();
+    kernel(xs, ys, zs, n, qx, qy, qz, dist_squared);
+}
+
+std::uint64_t radius_mask(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float rad_squared)
+{
+    static const RadiusMaskKernelF kernel = select_radius_mask_f();
+    return kernel(xs, ys, zs, n, qx, qy, qz, rad_squared);
+}
+
+void squared_distances(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float qx, float qy, float qz, float* dist_squared)
+{
+    static const SquaredDistancesKernelF kernel = select_squared_distances_f();
+    kernel(xs, ys, zs, n, qx, qy, qz, dist_squared);
+}
+
+} // end nnalgo
@@ -3,95 +3,102 @@
  * \brief Execute a nearest neighbors search on a set of 3D points.
  * \details This driver prompts the user to enter the path to a text file containing
  *          a list of 3D coordinates. The user is also prompted for a search radius
- *          value. A 3-d tree is then constructed using the input points. For each point 
- *          in the input, the point's neighbor(s) who are within the given radius are recorded. 
- *          The result of the nearest neighbors search for each point is output to stdout.
+ *          value. A 3-d tree (or, with -b grid, a uniform grid) is then constructed
+ *          using the input points. For each point in the input, the point's neighbor(s)
+ *          who are within the given radius are recorded. The result of the nearest
+ *          neighbors search for each point is output to stdout.
  */
 
 #include <vector>
 #include <string>
-#include <fstream>
+#include <thread>
 #include <iostream>
+#include <unistd.h>
 #include "3d_tree.h"
+#include "thread_pool.h"
+#include "uniform_grid.h"
+#include "point_io.h"
 
 using namespace nnalgo;
 
+/*!
+ * \brief Number of points held in each leaf bucket of the search tree.
+ */
+const std::size_t kLeafSize = 32;
+
 /*!
  * \brief Load the 3D points in \p point_file into \p points.
+ * \details Binary point files are recognized by their header. Any other file is parsed as text.
  * \param point_file Path to the 3D point data file.
+ * \param pool Thread pool used to parse the file.
  * \param points Vector of ingested 3D points.
  * \return True if all points are loaded from the input file.
  */
-bool load_points(const std::string& point_file, std::vector<ThreeDPoint>& points)
+bool load_points(const std::string& point_file, ThreadPool& pool, std::vector<ThreeDPoint>& points)
 {
-    std::ifstream point_file_handle(point_file);
-    if (!point_file_handle.is_open()) {
-        std::cerr << "Unable to open file: " << point_file << std::endl;
-        std::cerr << "Check that you provided a valid path." << std::endl;
-        return false;
-    }
-
-    int npoints = 0;
-    point_file_handle >> npoints;
-    if (npoints <= 0) {
-        std::cerr << "Invalid number of points: " << npoints << std::endl;
-        std::cerr << "The number of points must be positive." << std::endl;
-        return false;
-    }
-
-    double x = 0.0;
-    double y = 0.0;
-    double z = 0.0;
-    int i = 0;
-    while (point_file_handle && i < npoints) {
-        point_file_handle >> x >> y >> z;
-        points.emplace_back(ThreeDPoint(i+1, x, y, z));
-        i++;
-    }
-
-    if (npoints != i) {
-        std::cerr << "Unable to read " << npoints << ". Loaded only " << i << " points." << std::endl;
-        return false;
-    }
-
-    return true;
+    if (is_binary_point_file(point_file))
+        return load_binary_points(point_file, pool, points);
+    return load_text_points(point_file, pool, points);
 }
 
 /*!
- * \brief Print the contents of the \p results matrix to stdout.
+ * \brief Print the neighbor lists in \p results to stdout.
  * \details For each point, we print in the format
  *          point_id:[num_neighbors | neighbor_ids]
+ *          where list i of \p results holds the neighbors of the point with ID i+1.
  */
-void print_results(const std::vector<std::vector<int>>& results)
+void print_results(const NeighborLists& results)
 {
-    int n = results.size();
-    int m = results.front().size();
     std::cout << "------------- Start Search Results -------------" << std::endl;
-    for (int i = 0; i < n; ++i) {
+    for (std::size_t i = 0; i < results.size(); ++i) {
         std::cout << i+1 << ":[ ";
-        std::cout << results[i][0] << " | ";
-        for (int j = 1; j < m; j++) {
-            if (0 == results[i][j])
-                break;
-            std::cout << results[i][j] << ' ';
-        }
-        std::cout << "]" << std::endl;
+        std::cout << results.count(i) << " | ";
+        for (const unsigned int* n = results.begin(i); n != results.end(i); ++n)
+            std::cout << *n << ' ';
+        std::cout << "]\n";
     }
     std::cout << "------------- End Search Results --------------" << std::endl;
 }
 
 int main(int argc, char** argv)
 {
+    std::string backend = "tree";
+    std::string binary_file;
+    int opt = 0;
+    while (-1 != (opt = getopt(argc, argv, "b:w:"))) {
+        if ('b' == opt) {
+            backend = optarg;
+        } else if ('w' == opt) {
+            binary_file = optarg;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [-b tree|grid] [-w binary_file]" << std::endl;
+            return 1;
+        }
+    }
+    if (("tree" != backend) && ("grid" != backend)) {
+        std::cerr << "Invalid search backend: " << backend << std::endl;
+        std::cerr << "The backend must be one of tree or grid." << std::endl;
+        return 1;
+    }
+
     std::cout << "Enter the path (rel or abs) to the file containing your 3D points: ";
 
     std::string point_file;
     std::vector<ThreeDPoint> points;
     std::cin >> point_file;
     std::cout << "Loading points into memory..." << std::endl;
-    if (!load_points(point_file, points))
+    ThreadPool pool(std::thread::hardware_concurrency());
+    if (!load_points(point_file, pool, points))
         return 1;
     std::cout << "Points loaded successfully!" << std::endl;
 
+    if (!binary_file.empty()) {
+        if (!save_binary_points(binary_file, points, false))
+            return 1;
+        std::cout << "Points saved to " << binary_file << "." << std::endl;
+        return 0;
+    }
+
     std::cout << "Enter the search radius (double precision values accepted): ";
     double rad = 0.0;
     std::cin >> rad;
@@ -101,19 +108,22 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    ThreeDTree search_tree(points);
-    search_tree.print_tree();
-    std::vector<std::vector<int>> search_results(points.size(), std::vector<int>(points.size()+1, 0));
-    for (const auto& p : points) {
-        std::vector<ThreeDPoint> neighbors;
-        search_tree.radial_search(p, rad, neighbors);
+    // The tree reorders points, so search in ID order from a copy. The queries are run in Morton order, which
+    // keeps each worker in one part of the index, but their results are still listed in ID order.
+    std::vector<ThreeDPoint> queries(points.size());
+    for (const auto& p : points)
+        queries[p.id_-1] = p;
 
-        search_results[p.id_-1][0] = neighbors.size();
-        int i = 1;
-        for (const auto& n : neighbors)
-            search_results[p.id_-1][i++] = n.id_;
+    NeighborLists neighbors;
+    if ("grid" == backend) {
+        UniformGrid3D search_grid(points, rad);
+        search_grid.radial_search_batch(queries.data(), queries.size(), rad, pool, neighbors, true);
+    } else {
+        ThreeDTree search_tree(points, pool, kLeafSize);
+        search_tree.print_tree();
+        search_tree.radial_search_batch(queries.data(), queries.size(), rad, pool, neighbors, true);
     }
-    print_results(search_results);
+    print_results(neighbors);
 
     return 0;
 }
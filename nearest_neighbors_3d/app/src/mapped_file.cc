@@ -0,0 +1,40 @@
+/*!
+ * \file mapped_file.cc
+ * \brief MappedFile definition.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped_file.h"
+
+namespace nnalgo
+{
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        munmap(const_cast<char*>(data_), size_);
+}
+
+bool MappedFile::open(const std::string& path, bool sequential)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if ((0 == fstat(fd, &info)) && (info.st_size > 0)) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != data) {
+            data_ = static_cast<const char*>(data);
+            size_ = info.st_size;
+            madvise(data, size_, (sequential) ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+    }
+    close(fd);
+    return (nullptr != data_);
+}
+
+} // end nnalgo
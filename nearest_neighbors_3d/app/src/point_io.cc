@@ -0,0 +1,319 @@
+/*!
+ * \file point_io.cc
+ * \brief Point file loader definitions.
+ */
+
+#include <cstdio>
+#include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "point_io.h"
+#include "mapped_file.h"
+
+namespace nnalgo
+{
+
+namespace
+{
+
+const char kBinaryMagic[4] = {'N', 'N', '3', 'D'};
+const std::uint32_t kBinaryVersion = 1;
+
+bool is_space(char c)
+{
+    return ((' ' == c) || ('\t' == c) || ('\n' == c) || ('\r' == c) || ('\v' == c) || ('\f' == c));
+}
+
+bool is_digit(char c)
+{
+    return ((c >= '0') && (c <= '9'));
+}
+
+/*!
+ * \brief Parse a decimal floating point number from [\p p, \p end).
+ * \details Numbers with at most 19 significant digits whose mantissa fits in 53 bits and whose decimal
+ *          exponent lies in [-22, 22] are converted with a single, correctly rounded multiplication or
+ *          division (Clinger's fast path). This covers typical point files. Anything else is handed to
+ *          strtod(). Either way the result is identical to strtod()'s.
+ * \return Pointer one past the number, or nullptr if no number starts at \p p.
+ */
+const char* parse_double(const char* p, const char* end, double& value)
+{
+    static const double kPowersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* start = p;
+    bool negative = false;
+    if ((p < end) && (('-' == *p) || ('+' == *p)))
+        negative = ('-' == *p++);
+
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    bool truncated = false;
+    for (; (p < end) && is_digit(*p); ++p) {
+        any_digits = true;
+        if (digits < 19) {
+            mantissa = (mantissa * 10) + (*p - '0');
+            digits += (0 != mantissa);
+        } else {
+            exponent++;
+            truncated |= ('0' != *p);
+        }
+    }
+    if ((p < end) && ('.' == *p)) {
+        for (++p; (p < end) && is_digit(*p); ++p) {
+            any_digits = true;
+            if (digits < 19) {
+                mantissa = (mantissa * 10) + (*p - '0');
+                digits += (0 != mantissa);
+                exponent--;
+            } else {
+                truncated |= ('0' != *p);
+            }
+        }
+    }
+    if (!any_digits)
+        return nullptr;
+
+    if ((p < end) && (('e' == *p) || ('E' == *p))) {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if ((q < end) && (('-' == *q) || ('+' == *q)))
+            negative_exponent = ('-' == *q++);
+        if ((q < end) && is_digit(*q)) {
+            int e = 0;
+            for (; (q < end) && is_digit(*q); ++q)
+                e = std::min(100000, (e * 10) + (*q - '0'));
+            exponent += (negative_exponent) ? -e : e;
+            p = q;
+        }
+    }
+
+    if (!truncated && (mantissa <= (std::uint64_t(1) << 53)) && (exponent >= -22) && (exponent <= 22)) {
+        double result = static_cast<double>(mantissa);
+        result = (exponent < 0) ? (result / kPowersOfTen[-exponent]) : (result * kPowersOfTen[exponent]);
+        value = (negative) ? -result : result;
+        return p;
+    }
+
+    char buffer[128];
+    std::size_t length = p - start;
+    if (length >= sizeof(buffer))
+        return nullptr;
+    std::memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    value = std::strtod(buffer, nullptr);
+    return p;
+}
+
+const char* skip_space(const char* p, const char* end)
+{
+    while ((p < end) && is_space(*p))
+        ++p;
+    return p;
+}
+
+} // end anonymous namespace
+
+bool is_binary_point_file(const std::string& point_file)
+{
+    char magic[sizeof(kBinaryMagic)];
+    std::ifstream point_file_handle(point_file, std::ios::binary);
+    return (point_file_handle.read(magic, sizeof(magic)) &&
+            (0 == std::memcmp(magic, kBinaryMagic, sizeof(magic))));
+}
+
+bool load_text_points(const std::string& point_file, ThreadPool& pool, std::vector<ThreeDPoint>& points)
+{
+    MappedFile file;
+    if (!file.open(point_file, true)) {
+        std::cerr << "Unable to open file: " << point_file << std::endl;
+        std::cerr << "Check that you provided a valid path." << std::endl;
+        return false;
+    }
+
+    const char* begin = file.data();
+    const char* end = file.data() + file.size();
+    const char* p = skip_space(begin, end);
+    long npoints = 0;
+    for (; (p < end) && is_digit(*p); ++p)
+        npoints = std::min(1L << 40, (npoints * 10) + (*p - '0'));
+    if ((npoints <= 0) || ((p < end) && !is_space(*p))) {
+        std::cerr << "Invalid number of points: " << npoints << std::endl;
+        std::cerr << "The number of points must be positive." << std::endl;
+        return false;
+    }
+
+    // Split the body into chunks that begin on line boundaries.
+    const std::size_t nchunks = std::max<std::size_t>(1, pool.size() * 4);
+    std::vector<const char*> bounds(nchunks + 1, end);
+    bounds[0] = p;
+    for (std::size_t c = 1; c < nchunks; ++c) {
+        const char* split = std::max(bounds[c-1], p + ((end - p) * c) / nchunks);
+        const char* newline = static_cast<const char*>(std::memchr(split, '\n', end - split));
+        bounds[c] = (newline) ? (newline + 1) : end;
+    }
+
+    std::vector<std::vector<ThreeDPoint>> chunk_points(nchunks);
+    std::vector<char> chunk_failed(nchunks, 0);
+    pool.run(nchunks, [&](std::size_t c, unsigned) {
+        const char* q = skip_space(bounds[c], bounds[c+1]);
+        std::vector<ThreeDPoint>& out = chunk_points[c];
+        out.reserve((bounds[c+1] - bounds[c]) / 24);
+        while (q < bounds[c+1]) {
+            double coords[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                q = skip_space(q, bounds[c+1]);
+                const char* next = (q < bounds[c+1]) ? parse_double(q, bounds[c+1], coords[axis]) : nullptr;
+                if (!next || ((next < bounds[c+1]) && !is_space(*next))) {
+                    chunk_failed[c] = 1;
+                    return;
+                }
+                q = next;
+            }
+            out.emplace_back(0, coords[0], coords[1], coords[2]);
+            q = skip_space(q, bounds[c+1]);
+        }
+    });
+
+    // Points past a malformed line are not loaded, so the count check below reports the failure.
+    std::vector<std::size_t> offsets(nchunks + 1, 0);
+    std::size_t nchunks_used = nchunks;
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        offsets[c+1] = offsets[c] + chunk_points[c].size();
+        if (chunk_failed[c] || (offsets[c+1] >= static_cast<std::size_t>(npoints))) {
+            nchunks_used = c + 1;
+            break;
+        }
+    }
+    const std::size_t nloaded = std::min<std::size_t>(npoints, offsets[nchunks_used]);
+    if (static_cast<std::size_t>(npoints) != nloaded) {
+        std::cerr << "Unable to read " << npoints << ". Loaded only " << nloaded << " points." << std::endl;
+        return false;
+    }
+
+    points.resize(nloaded);
+    pool.run(nchunks_used, [&](std::size_t c, unsigned) {
+        for (std::size_t i = 0; i < chunk_points[c].size() && (offsets[c] + i) < nloaded; ++i) {
+            const ThreeDPoint& src = chunk_points[c][i];
+            points[offsets[c] + i] = ThreeDPoint(offsets[c] + i + 1, src.x_, src.y_, src.z_);
+        }
+        std::vector<ThreeDPoint>().swap(chunk_points[c]);
+    });
+
+    return true;
+}
+
+bool map_binary_points(const std::string& point_file, MappedFile& file, BinaryPointHeader& header)
+{
+    if (!file.open(point_file, true)) {
+        std::cerr << "Unable to open file: " << point_file << std::endl;
+        std::cerr << "Check that you provided a valid path." << std::endl;
+        return false;
+    }
+
+    if (file.size() < sizeof(header)) {
+        std::cerr << "Truncated binary point file header: " << point_file << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if ((0 != std::memcmp(header.magic_, kBinaryMagic, sizeof(kBinaryMagic))) ||
+            (kBinaryVersion != header.version_) ||
+            ((sizeof(float) != header.scalar_size_) && (sizeof(double) != header.scalar_size_))) {
+        std::cerr << "Unsupported binary point file: " << point_file << std::endl;
+        return false;
+    }
+    if ((0 == header.count_) ||
+            (((file.size() - sizeof(header)) / (3 * header.scalar_size_)) < header.count_)) {
+        std::cerr << "Invalid number of points: " << header.count_ << std::endl;
+        std::cerr << "The number of points must be positive and fit in the file." << std::endl;
+        return false;
+    }
+    if (header.count_ > std::numeric_limits<std::uint32_t>::max()) {
+        std::cerr << "Too many points: " << header.count_ << std::endl;
+        std::cerr << "Point IDs are 32-bit, so a file holds at most " << std::numeric_limits<std::uint32_t>::max()
+                << " points." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool load_binary_points(const std::string& point_file, ThreadPool& pool, std::vector<ThreeDPoint>& points)
+{
+    MappedFile file;
+    BinaryPointHeader header;
+    if (!map_binary_points(point_file, file, header))
+        return false;
+
+    const char* payload = file.data() + sizeof(header);
+    const std::size_t npoints = header.count_;
+    const std::size_t nchunks = std::max<std::size_t>(1, pool.size() * 4);
+    points.resize(npoints);
+    pool.run(nchunks, [&](std::size_t c, unsigned) {
+        std::size_t begin = (npoints * c) / nchunks;
+        std::size_t end = (npoints * (c + 1)) / nchunks;
+        for (std::size_t i = begin; i < end; ++i) {
+            if (sizeof(float) == header.scalar_size_) {
+                float xyz[3];
+                std::memcpy(xyz, payload + (i * sizeof(xyz)), sizeof(xyz));
+                points[i] = ThreeDPoint(i + 1, xyz[0], xyz[1], xyz[2]);
+            } else {
+                double xyz[3];
+                std::memcpy(xyz, payload + (i * sizeof(xyz)), sizeof(xyz));
+                points[i] = ThreeDPoint(i + 1, xyz[0], xyz[1], xyz[2]);
+            }
+        }
+    });
+
+    return true;
+}
+
+bool save_binary_points(const std::string& point_file, const std::vector<ThreeDPoint>& points,
+        bool single_precision)
+{
+    BinaryPointHeader header;
+    std::memcpy(header.magic_, kBinaryMagic, sizeof(kBinaryMagic));
+    header.version_ = kBinaryVersion;
+    header.scalar_size_ = (single_precision) ? sizeof(float) : sizeof(double);
+    header.reserved_ = 0;
+    header.count_ = points.size();
+
+    // Write the points in ID order regardless of how they are arranged in memory.
+    std::vector<char> payload(points.size() * 3 * header.scalar_size_);
+    std::vector<char> seen(points.size(), 0);
+    for (const ThreeDPoint& p : points) {
+        if ((0 == p.id_) || (p.id_ > points.size()) || seen[p.id_-1]) {
+            std::cerr << "Point IDs must be unique and range from 1 to " << points.size() << "." << std::endl;
+            return false;
+        }
+        seen[p.id_-1] = 1;
+        char* slot = payload.data() + ((p.id_ - 1) * 3 * header.scalar_size_);
+        if (single_precision) {
+            float xyz[3] = {static_cast<float>(p.x_), static_cast<float>(p.y_), static_cast<float>(p.z_)};
+            std::memcpy(slot, xyz, sizeof(xyz));
+        } else {
+            double xyz[3] = {p.x_, p.y_, p.z_};
+            std::memcpy(slot, xyz, sizeof(xyz));
+        }
+    }
+
+    std::ofstream point_file_handle(point_file, std::ios::binary | std::ios::trunc);
+    point_file_handle.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    point_file_handle.write(payload.data(), payload.size());
+    if (!point_file_handle) {
+        std::cerr << "Unable to write file: " << point_file << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+} // end nnalgo
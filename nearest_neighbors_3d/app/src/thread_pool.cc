@@ -0,0 +1,77 @@
+/*!
+ * \file thread_pool.cc
+ * \brief ThreadPool definition.
+ */
+
+#include "thread_pool.h"
+
+namespace nnalgo
+{
+
+ThreadPool::ThreadPool(unsigned nthreads) :
+    task_(nullptr), ntasks_(0), next_task_(0), generation_(0), active_(0), stop_(false)
+{
+    for (unsigned w = 1; w < nthreads; ++w)
+        workers_.emplace_back(&ThreadPool::work, this, w);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& w : workers_)
+        w.join();
+}
+
+void ThreadPool::run(std::size_t ntasks, const Task& task)
+{
+    if (!ntasks)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        ntasks_ = ntasks;
+        next_task_.store(0);
+        active_ = static_cast<unsigned>(workers_.size());
+        generation_++;
+    }
+    start_.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return (0 == active_); });
+    task_ = nullptr;
+}
+
+void ThreadPool::work(unsigned worker)
+{
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [this, seen] { return (stop_ || (generation_ != seen)); });
+            if (stop_)
+                return;
+            seen = generation_;
+        }
+
+        drain(worker);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (0 == --active_)
+            done_.notify_one();
+    }
+}
+
+void ThreadPool::drain(unsigned worker)
+{
+    for (std::size_t i = next_task_.fetch_add(1); i < ntasks_; i = next_task_.fetch_add(1))
+        (*task_)(i, worker);
+}
+
+} // end nnalgo
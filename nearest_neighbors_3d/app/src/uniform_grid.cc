@@ -0,0 +1,201 @@
+/*!
+ * \file uniform_grid.cc
+ * \brief UniformGrid3D definition.
+ */
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "morton.h"
+#include "uniform_grid.h"
+#include "distance_kernels.h"
+
+namespace nnalgo
+{
+
+namespace
+{
+
+/*!
+ * \brief Largest number of cells allocated per point.
+ */
+const double kMaxCellsPerPoint = 8.0;
+
+} // end anonymous namespace
+
+UniformGrid3D::UniformGrid3D(const std::vector<ThreeDPoint>& coords, double cell_size) :
+    origin_{0.0, 0.0, 0.0}, cell_size_(1.0), dims_{1, 1, 1}
+{
+    double extent[3] = {0.0, 0.0, 0.0};
+    if (!coords.empty()) {
+        double hi[3];
+        for (int axis = 0; axis < 3; ++axis)
+            origin_[axis] = hi[axis] = coords.front()[axis];
+        for (const ThreeDPoint& p : coords) {
+            for (int axis = 0; axis < 3; ++axis) {
+                origin_[axis] = std::min(origin_[axis], p[axis]);
+                hi[axis] = std::max(hi[axis], p[axis]);
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis)
+            extent[axis] = hi[axis] - origin_[axis];
+    }
+
+    // Grow the cells until the grid is no larger than kMaxCellsPerPoint cells per point.
+    const double max_cells = std::max(1.0, kMaxCellsPerPoint * coords.size());
+    cell_size_ = (cell_size > 0) ? cell_size : 1.0;
+    for (;;) {
+        double ncells = 1.0;
+        for (int axis = 0; axis < 3; ++axis)
+            ncells *= std::floor(extent[axis] / cell_size_) + 1;
+        if (ncells <= max_cells)
+            break;
+        cell_size_ *= std::cbrt(ncells / max_cells) * 1.01;
+    }
+    for (int axis = 0; axis < 3; ++axis)
+        dims_[axis] = static_cast<long>(std::floor(extent[axis] / cell_size_)) + 1;
+
+    // Counting sort the points by cell.
+    const std::size_t ncells = dims_[0] * dims_[1] * dims_[2];
+    std::vector<std::size_t> cells(coords.size());
+    cell_start_.assign(ncells + 1, 0);
+    for (std::size_t i = 0; i < coords.size(); ++i) {
+        cells[i] = cell_index(cell_of(coords[i].x_, 0), cell_of(coords[i].y_, 1), cell_of(coords[i].z_, 2));
+        cell_start_[cells[i] + 1]++;
+    }
+    for (std::size_t c = 0; c < ncells; ++c)
+        cell_start_[c+1] += cell_start_[c];
+
+    std::vector<std::size_t> next(cell_start_.begin(), cell_start_.end() - 1);
+    ids_.resize(coords.size());
+    xs_.resize(coords.size());
+    ys_.resize(coords.size());
+    zs_.resize(coords.size());
+    for (std::size_t i = 0; i < coords.size(); ++i) {
+        std::size_t slot = next[cells[i]]++;
+        ids_[slot] = coords[i].id_;
+        xs_[slot] = coords[i].x_;
+        ys_[slot] = coords[i].y_;
+        zs_[slot] = coords[i].z_;
+    }
+}
+
+long UniformGrid3D::cell_of(double value, int axis) const
+{
+    double cell = std::floor((value - origin_[axis]) / cell_size_);
+    if (!(cell > 0))
+        return 0;
+    return std::min(static_cast<long>(std::min(cell, 1e18)), dims_[axis] - 1);
+}
+
+void UniformGrid3D::radial_search(const ThreeDPoint& ref, double rad, std::vector<ThreeDPoint>& neighbors) const
+{
+    auto visit = [this, &neighbors](std::size_t i) {
+        neighbors.emplace_back(ids_[i], xs_[i], ys_[i], zs_[i]);
+    };
+    radial_search_(ref, rad, visit);
+}
+
+void UniformGrid3D::radial_search(const ThreeDPoint& ref, double rad, std::vector<unsigned int>& neighbor_ids) const
+{
+    auto visit = [this, &neighbor_ids](std::size_t i) { neighbor_ids.push_back(ids_[i]); };
+    radial_search_(ref, rad, visit);
+}
+
+void UniformGrid3D::radial_search_batch(const ThreeDPoint* queries, std::size_t nqueries, double rad,
+        ThreadPool& pool, NeighborLists& neighbors, bool reorder) const
+{
+    auto search = [this, rad](const ThreeDPoint& ref, std::vector<unsigned int>& found) {
+        auto visit = [this, &found](std::size_t i) { found.push_back(ids_[i]); };
+        radial_search_(ref, rad, visit);
+    };
+    std::vector<std::size_t> order;
+    if (reorder) {
+        auto location = [queries](std::size_t i, double* out) {
+            out[0] = queries[i].x_;
+            out[1] = queries[i].y_;
+            out[2] = queries[i].z_;
+        };
+        morton_order<double, 3>(nqueries, location, order);
+    }
+    collect_neighbor_lists(queries, nqueries, pool, search, neighbors, (reorder) ? order.data() : nullptr);
+}
+
+void UniformGrid3D::radial_self_join(double rad, bool symmetric,
+        std::vector<std::pair<unsigned int, unsigned int>>& pairs) const
+{
+    const double rad_squared = rad * rad;
+    const long reach = static_cast<long>(std::ceil(rad / cell_size_));
+
+    auto scan = [&](std::size_t i, std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; j += kRadiusMaskWidth) {
+            std::size_t count = std::min(kRadiusMaskWidth, end - j);
+            std::uint64_t mask = radius_mask(&xs_[j], &ys_[j], &zs_[j], count, xs_[i], ys_[i], zs_[i],
+                    rad_squared);
+            for (; mask; mask &= (mask - 1)) {
+                unsigned int a = ids_[i];
+                unsigned int b = ids_[j + __builtin_ctzll(mask)];
+                pairs.emplace_back(std::min(a, b), std::max(a, b));
+                if (symmetric)
+                    pairs.emplace_back(std::max(a, b), std::min(a, b));
+            }
+        }
+    };
+
+    for (long z = 0; z < dims_[2]; ++z) {
+        for (long y = 0; y < dims_[1]; ++y) {
+            for (long x = 0; x < dims_[0]; ++x) {
+                std::size_t cell = cell_index(x, y, z);
+                long x_lo = std::max(0L, x - reach);
+                long x_hi = std::min(dims_[0] - 1, x + reach);
+                for (std::size_t i = cell_start_[cell]; i < cell_start_[cell+1]; ++i) {
+                    // The rest of this cell and the cells after it on the same row.
+                    scan(i, i + 1, cell_start_[cell_index(x_hi, y, z) + 1]);
+
+                    // Rows after this one on the same plane, then the planes after this one.
+                    for (long dz = 0; dz <= reach && (z + dz) < dims_[2]; ++dz) {
+                        long y_lo = (0 == dz) ? (y + 1) : std::max(0L, y - reach);
+                        long y_hi = std::min(dims_[1] - 1, y + reach);
+                        for (long ny = y_lo; ny <= y_hi; ++ny)
+                            scan(i, cell_start_[cell_index(x_lo, ny, z + dz)],
+                                    cell_start_[cell_index(x_hi, ny, z + dz) + 1]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Visitor>
+void UniformGrid3D::radial_search_(const ThreeDPoint& ref, double rad, Visitor& visit) const
+{
+    if (ids_.empty())
+        return;
+
+    const double rad_squared = rad * rad;
+    long lo[3];
+    long hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        // Skip the search entirely if the ball misses the grid on this axis.
+        if (((ref[axis] + rad) < origin_[axis]) || ((ref[axis] - rad) > (origin_[axis] + dims_[axis] * cell_size_)))
+            return;
+        lo[axis] = cell_of(ref[axis] - rad, axis);
+        hi[axis] = cell_of(ref[axis] + rad, axis);
+    }
+
+    for (long z = lo[2]; z <= hi[2]; ++z) {
+        for (long y = lo[1]; y <= hi[1]; ++y) {
+            // Cells along the x-axis are stored back to back, so the whole row is one block.
+            std::size_t end = cell_start_[cell_index(hi[0], y, z) + 1];
+            for (std::size_t i = cell_start_[cell_index(lo[0], y, z)]; i < end; i += kRadiusMaskWidth) {
+                std::size_t count = std::min(kRadiusMaskWidth, end - i);
+                std::uint64_t mask = radius_mask(&xs_[i], &ys_[i], &zs_[i], count, ref.x_, ref.y_, ref.z_,
+                        rad_squared);
+                for (; mask; mask &= (mask - 1))
+                    visit(i + __builtin_ctzll(mask));
+            }
+        }
+    }
+}
+
+} // end nnalgo
@@ -0,0 +1,105 @@
+/*!
+ * \file verlet_lists.cc
+ * \brief VerletLists definition.
+ */
+
+#include <tuple>
+#include <algorithm>
+#include "verlet_lists.h"
+#include "3d_tree.h"
+
+namespace nnalgo
+{
+
+namespace
+{
+
+/*!
+ * \brief Leaf bucket size of the tree used to find candidate neighbors.
+ */
+const std::size_t kVerletLeafSize = 32;
+
+/*!
+ * \brief Compute the square of the distance between \p a and \p b.
+ */
+double distance_squared(const ThreeDPoint& a, const ThreeDPoint& b)
+{
+    double dx = a.x_ - b.x_;
+    double dy = a.y_ - b.y_;
+    double dz = a.z_ - b.z_;
+    return (dx * dx) + (dy * dy) + (dz * dz);
+}
+
+} // end anonymous
+
+VerletLists::VerletLists(double rad, double skin) : rad_(rad), skin_(skin), rebuilds_(0) { }
+
+bool VerletLists::update(const std::vector<ThreeDPoint>& points, ThreadPool& pool)
+{
+    bool stale = (points.size() != reference_.size());
+    const double half_skin_squared = (skin_ / 2) * (skin_ / 2);
+    for (std::size_t i = 0; !stale && (i < points.size()); ++i)
+        stale = (distance_squared(points[i], reference_[i]) > half_skin_squared);
+    if (stale)
+        rebuild(points);
+
+    const ThreeDPoint* first = points.data();
+    const double rad_squared = rad_ * rad_;
+    auto search = [this, &points, first, rad_squared](const ThreeDPoint& ref, std::vector<unsigned int>& found) {
+        std::size_t i = &ref - first;
+        for (const unsigned int* j = candidates_.begin(i); j != candidates_.end(i); ++j) {
+            double dist_squared = distance_squared(ref, points[*j]);
+            if ((dist_squared <= rad_squared) && (0 != dist_squared))
+                found.push_back(points[*j].id_);
+        }
+    };
+    collect_neighbor_lists(first, points.size(), pool, search, neighbors_);
+    return stale;
+}
+
+void VerletLists::rebuild(const std::vector<ThreeDPoint>& points)
+{
+    rebuilds_++;
+    reference_ = points;
+
+    // Label each point by its index so that the self-join reports index pairs.
+    std::vector<ThreeDPoint> coords(points);
+    for (std::size_t i = 0; i < coords.size(); ++i)
+        coords[i].id_ = static_cast<unsigned int>(i);
+    std::vector<std::pair<unsigned int, unsigned int>> pairs;
+    {
+        ThreeDTree tree(coords, 1, kVerletLeafSize);
+        tree.radial_self_join(rad_ + skin_, true, pairs);
+    }
+
+    // The self-join never pairs coincident points, which may yet move apart, so pair them here.
+    std::vector<unsigned int> order(points.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<unsigned int>(i);
+    auto location = [&points](unsigned int i) { return std::make_tuple(points[i].x_, points[i].y_, points[i].z_); };
+    std::sort(order.begin(), order.end(), [&location](unsigned int a, unsigned int b) {
+        return (location(a) < location(b));
+    });
+    for (std::size_t run = 0, end = 0; run < order.size(); run = end) {
+        for (end = run + 1; (end < order.size()) && (location(order[end]) == location(order[run])); ++end) { }
+        for (std::size_t a = run; a < end; ++a) {
+            for (std::size_t b = run; b < end; ++b) {
+                if (a != b)
+                    pairs.emplace_back(order[a], order[b]);
+            }
+        }
+    }
+
+    // Counting sort the pairs into compressed sparse row lists.
+    candidates_.offsets_.assign(points.size() + 1, 0);
+    for (const auto& p : pairs)
+        candidates_.offsets_[p.first + 1]++;
+    for (std::size_t i = 0; i < points.size(); ++i)
+        candidates_.offsets_[i+1] += candidates_.offsets_[i];
+    candidates_.ids_.resize(pairs.size());
+    std::vector<std::size_t> next(candidates_.offsets_.begin(), candidates_.offsets_.end() - 1);
+    for (const auto& p : pairs)
+        candidates_.ids_[next[p.first]++] = p.second;
+}
+
+} // end nnalgo
@@ -3,11 +3,98 @@
  * \brief Unit test the 3-D tree's radial search functionality.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "3d_tree.h"
+#include "kd_tree_file.h"
+#include "thread_pool.h"
+#include "uniform_grid.h"
+#include "verlet_lists.h"
+#include "point_io.h"
 #include "gtest/gtest.h"
 
 using namespace nnalgo;
 
+namespace
+{
+
+/*!
+ * \brief Find the IDs of the points in \p points within \p rad of \p ref by linear scan, in ascending order.
+ * \details Points coincident with \p ref are skipped, as the searches skip the reference point itself.
+ */
+std::vector<unsigned> brute_force_radial_ids(const std::vector<ThreeDPoint>& points, const ThreeDPoint& ref,
+        double rad)
+{
+    std::vector<unsigned> ids;
+    for (const ThreeDPoint& o : points) {
+        double dx = ref.x_ - o.x_, dy = ref.y_ - o.y_, dz = ref.z_ - o.z_;
+        double d = (dx * dx) + (dy * dy) + (dz * dz);
+        if ((d <= rad * rad) && (0 != d))
+            ids.push_back(o.id_);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+/*!
+ * \brief Find the IDs of the points in \p points by linear scan, nearest to \p ref first.
+ * \details Points coincident with \p ref are skipped, as the searches skip the reference point itself.
+ */
+std::vector<unsigned> brute_force_nearest_ids(const std::vector<ThreeDPoint>& points, const ThreeDPoint& ref)
+{
+    std::vector<std::pair<double, unsigned>> nearest;
+    for (const ThreeDPoint& o : points) {
+        double dx = ref.x_ - o.x_, dy = ref.y_ - o.y_, dz = ref.z_ - o.z_;
+        double d = (dx * dx) + (dy * dy) + (dz * dz);
+        if (0 != d)
+            nearest.emplace_back(d, o.id_);
+    }
+    std::sort(nearest.begin(), nearest.end());
+
+    std::vector<unsigned> ids;
+    for (const auto& n : nearest)
+        ids.push_back(n.second);
+    return ids;
+}
+
+/*!
+ * \brief Get the IDs of \p neighbors in ascending order.
+ */
+std::vector<unsigned> sorted_ids(const std::vector<ThreeDPoint>& neighbors)
+{
+    std::vector<unsigned> ids;
+    for (const ThreeDPoint& n : neighbors)
+        ids.push_back(n.id_);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+/*!
+ * \brief Check the radial_search() results of every \p stride-th point of \p points against brute force.
+ */
+template <typename Tree>
+void check_radial_matches_brute_force(const Tree& search_tree, const std::vector<ThreeDPoint>& points, double rad,
+        std::size_t stride)
+{
+    for (std::size_t q = 0; q < points.size(); q += stride) {
+        std::vector<ThreeDPoint> neighbors;
+        search_tree.radial_search(points[q], rad, neighbors);
+        ASSERT_EQ(sorted_ids(neighbors), brute_force_radial_ids(points, points[q], rad));
+    }
+}
+
+} // end anonymous namespace
+
 TEST(NNSearch, OutOfRadiusSearch)
 {
     std::vector<ThreeDPoint> points;
@@ -45,6 +132,800 @@ TEST(NNSearch, InRadiusSearchValidPoint)
     ASSERT_EQ(neighbors[1].id_, expected_result[1].id_);
 }
 
+TEST(NNSearch, EmptyTree)
+{
+    std::vector<ThreeDPoint> points;
+    ThreeDTree search_tree(points);
+
+    std::vector<ThreeDPoint> neighbors;
+    search_tree.radial_search(ThreeDPoint(1,0,0,0), 1.0, neighbors);
+
+    ASSERT_TRUE(neighbors.empty());
+}
+
+TEST(NNSearch, MatchesBruteForce)
+{
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 1000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    ThreeDTree search_tree(points);
+    check_radial_matches_brute_force(search_tree, original, 1.5, 1);
+}
+
+TEST(NNSearch, ParallelBuildMatchesBruteForce)
+{
+    // Integer coordinates produce many ties on every axis.
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> dist(0, 63);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 200000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    ThreeDTree search_tree(points, 4);
+    check_radial_matches_brute_force(search_tree, original, 2.0, 997);
+
+    // A pool whose size is not a power of two splits some levels a node per task before building subtrees.
+    ThreadPool pool(3);
+    points = original;
+    ThreeDTree pool_tree(points, pool, 8);
+    check_radial_matches_brute_force(pool_tree, original, 2.0, 997);
+    ASSERT_EQ(pool_tree.overlap(), 0.0);
+}
+
+TEST(NNSearch, BucketedLeavesMatchBruteForce)
+{
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> dist(-5.0, 5.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 5000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    for (std::size_t leaf_size : {5, 8, 32, 64, 100}) {
+        points = original;
+        ThreeDTree search_tree(points, 1, leaf_size);
+        SCOPED_TRACE("leaf_size " + std::to_string(leaf_size));
+        check_radial_matches_brute_force(search_tree, original, 1.25, 37);
+    }
+}
+
+TEST(NNSearch, KnnMatchesBruteForce)
+{
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 3000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    for (std::size_t leaf_size : {1, 16}) {
+        points = original;
+        ThreeDTree search_tree(points, 1, leaf_size);
+
+        for (std::size_t k : {1, 8, 64}) {
+            for (std::size_t q = 0; q < original.size(); q += 101) {
+                const ThreeDPoint& p = original[q];
+                std::vector<ThreeDPoint> neighbors;
+                search_tree.knn_search(p, k, neighbors);
+
+                std::vector<unsigned> expected = brute_force_nearest_ids(original, p);
+                ASSERT_EQ(neighbors.size(), k);
+                for (std::size_t i = 0; i < k; ++i)
+                    ASSERT_EQ(neighbors[i].id_, expected[i]);
+            }
+        }
+    }
+}
+
+TEST(NNSearch, KnnFewerPointsThanK)
+{
+    std::vector<ThreeDPoint> points;
+    points.emplace_back(ThreeDPoint(1,0,0,0));
+    points.emplace_back(ThreeDPoint(2,0,0,1));
+    points.emplace_back(ThreeDPoint(3,0.5,0.5,0.5));
+
+    ThreeDTree search_tree(points);
+
+    std::vector<ThreeDPoint> neighbors;
+    search_tree.knn_search(ThreeDPoint(1,0,0,0), 8, neighbors);
+
+    ASSERT_EQ(neighbors.size(), 2);
+    ASSERT_EQ(neighbors[0].id_, 3);
+    ASSERT_EQ(neighbors[1].id_, 2);
+}
+
+TEST(NNSearch, BatchMatchesRadialSearch)
+{
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 4000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> queries = points;
+
+    ThreeDTree search_tree(points, 1, 16);
+    ThreadPool pool(3);
+    NeighborLists neighbors;
+    search_tree.radial_search_batch(queries.data(), queries.size(), 1.0, pool, neighbors);
+
+    ASSERT_EQ(neighbors.size(), queries.size());
+    for (std::size_t q = 0; q < queries.size(); ++q) {
+        std::vector<ThreeDPoint> expected;
+        search_tree.radial_search(queries[q], 1.0, expected);
+        std::vector<unsigned> found(neighbors.begin(q), neighbors.end(q));
+        std::sort(found.begin(), found.end());
+        ASSERT_EQ(found, sorted_ids(expected));
+    }
+}
+
+TEST(NNSearch, SelfJoinMatchesRadialSearch)
+{
+    // Integer coordinates make whole node pairs fall within the radius and include coincident points.
+    std::mt19937 gen(9);
+    std::uniform_int_distribution<int> dist(0, 15);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 3000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    for (std::size_t leaf_size : {1, 8}) {
+        points = original;
+        ThreeDTree search_tree(points, 1, leaf_size);
+
+        std::vector<std::pair<unsigned int, unsigned int>> expected;
+        for (const ThreeDPoint& p : original) {
+            std::vector<ThreeDPoint> neighbors;
+            search_tree.radial_search(p, 2.5, neighbors);
+            for (const ThreeDPoint& n : neighbors)
+                expected.emplace_back(p.id_, n.id_);
+        }
+        std::sort(expected.begin(), expected.end());
+
+        std::vector<std::pair<unsigned int, unsigned int>> pairs;
+        search_tree.radial_self_join(2.5, true, pairs);
+        std::sort(pairs.begin(), pairs.end());
+        ASSERT_EQ(pairs, expected);
+
+        pairs.clear();
+        search_tree.radial_self_join(2.5, false, pairs);
+        ASSERT_EQ(pairs.size() * 2, expected.size());
+        for (const auto& pair : pairs)
+            ASSERT_LT(pair.first, pair.second);
+    }
+}
+
+TEST(NNSearch, UniformGridMatchesTree)
+{
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<double> dist(-20.0, 20.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 4000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), std::round(dist(gen))));
+    const std::vector<ThreeDPoint> original = points;
+    ThreeDTree search_tree(points, 1, 8);
+
+    // A cell size equal to the radius and one smaller than it.
+    for (double cell_size : {3.0, 1.3}) {
+        UniformGrid3D grid(original, cell_size);
+
+        std::vector<std::pair<unsigned int, unsigned int>> expected;
+        search_tree.radial_self_join(3.0, false, expected);
+        std::sort(expected.begin(), expected.end());
+        std::vector<std::pair<unsigned int, unsigned int>> pairs;
+        grid.radial_self_join(3.0, false, pairs);
+        std::sort(pairs.begin(), pairs.end());
+        ASSERT_EQ(pairs, expected);
+
+        for (std::size_t q = 0; q < original.size(); q += 53) {
+            std::vector<ThreeDPoint> tree_neighbors;
+            std::vector<ThreeDPoint> grid_neighbors;
+            search_tree.radial_search(original[q], 3.0, tree_neighbors);
+            grid.radial_search(original[q], 3.0, grid_neighbors);
+            ASSERT_EQ(sorted_ids(grid_neighbors), sorted_ids(tree_neighbors));
+        }
+    }
+
+    // Reference points outside the grid.
+    UniformGrid3D grid(original, 3.0);
+    std::vector<ThreeDPoint> neighbors;
+    grid.radial_search(ThreeDPoint(0, 100, 100, 100), 3.0, neighbors);
+    ASSERT_TRUE(neighbors.empty());
+}
+
+TEST(NNSearch, CountAndAnyMatchBruteForce)
+{
+    std::mt19937 gen(61);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 2000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    // A coincident pair must not count each other.
+    points.emplace_back(ThreeDPoint(2001, points[0].x_, points[0].y_, points[0].z_));
+    const std::vector<ThreeDPoint> original = points;
+
+    for (std::size_t leaf_size : {1, 8}) {
+        points = original;
+        ThreeDTree search_tree(points, 1, leaf_size);
+        for (double rad : {0.3, 1.5, 6.0, 20.0}) {
+            for (std::size_t q = 0; q < original.size(); q += 7) {
+                const ThreeDPoint& p = original[q];
+                std::size_t expected = brute_force_radial_ids(original, p, rad).size();
+                ASSERT_EQ(search_tree.radial_count(p, rad), expected);
+                ASSERT_EQ(search_tree.radial_any(p, rad), (expected > 0));
+            }
+        }
+    }
+}
+
+TEST(NNSearch, IdOverloadsMatchPointSearch)
+{
+    std::mt19937 gen(71);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 2000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    ThreeDTree search_tree(points, 1, 8);
+    UniformGrid3D grid(original, 1.5);
+    std::vector<unsigned> ids;
+    for (std::size_t q = 0; q < original.size(); q += 11) {
+        const ThreeDPoint& p = original[q];
+        std::vector<ThreeDPoint> neighbors;
+        search_tree.radial_search(p, 1.5, neighbors);
+        std::vector<unsigned> expected;
+        for (const ThreeDPoint& n : neighbors)
+            expected.push_back(n.id_);
+
+        // The ID buffer is reused across queries.
+        ids.clear();
+        search_tree.radial_search(p, 1.5, ids);
+        ASSERT_EQ(ids, expected);
+
+        std::vector<unsigned> visited;
+        search_tree.radial_visit(p, 1.5, [&visited](unsigned id) { visited.push_back(id); });
+        ASSERT_EQ(visited, expected);
+
+        ids.clear();
+        grid.radial_search(p, 1.5, ids);
+        std::sort(ids.begin(), ids.end());
+        std::sort(expected.begin(), expected.end());
+        ASSERT_EQ(ids, expected);
+
+        neighbors.clear();
+        search_tree.knn_search(p, 10, neighbors);
+        ids.clear();
+        search_tree.knn_search(p, 10, ids);
+        ASSERT_EQ(ids.size(), neighbors.size());
+        for (std::size_t i = 0; i < ids.size(); ++i)
+            ASSERT_EQ(ids[i], neighbors[i].id_);
+    }
+}
+
+TEST(NNSearch, MappedTreeMatchesOriginal)
+{
+    std::mt19937 gen(83);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 3000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const std::vector<ThreeDPoint> original = points;
+
+    const std::string path = "kd_tree_test.nnkd";
+    ThreeDTree search_tree(points, 2, 16);
+    ASSERT_TRUE(search_tree.save(path));
+    std::unique_ptr<ThreeDTree> mapped = ThreeDTree::open_mapped(path);
+    ASSERT_NE(nullptr, mapped);
+    ASSERT_TRUE(mapped->is_mapped());
+    ASSERT_FALSE(search_tree.is_mapped());
+    ASSERT_EQ(mapped->size(), search_tree.size());
+    ASSERT_EQ(mapped->overlap(), search_tree.overlap());
+
+    for (std::size_t q = 0; q < original.size(); q += 13) {
+        const ThreeDPoint& p = original[q];
+        std::vector<unsigned> expected;
+        std::vector<unsigned> found;
+        search_tree.radial_search(p, 1.5, expected);
+        mapped->radial_search(p, 1.5, found);
+        ASSERT_EQ(found, expected);
+        ASSERT_EQ(mapped->radial_count(p, 1.5), expected.size());
+
+        expected.clear();
+        found.clear();
+        search_tree.knn_search(p, 8, expected);
+        mapped->knn_search(p, 8, found);
+        ASSERT_EQ(found, expected);
+    }
+
+    std::vector<std::pair<unsigned int, unsigned int>> expected_pairs;
+    std::vector<std::pair<unsigned int, unsigned int>> found_pairs;
+    search_tree.radial_self_join(0.5, false, expected_pairs);
+    mapped->radial_self_join(0.5, false, found_pairs);
+    ASSERT_EQ(found_pairs, expected_pairs);
+
+    // A tree of another coordinate type, or a file which is not a tree, is rejected.
+    ASSERT_EQ(nullptr, (KdTree<float, 3>::open_mapped(path)));
+    const std::string text_path = "kd_tree_test.txt";
+    {
+        std::ofstream not_a_tree(text_path, std::ios::trunc);
+        not_a_tree << "3\n0 0 0\n1 1 1\n2 2 2\n";
+    }
+    ASSERT_EQ(nullptr, ThreeDTree::open_mapped(text_path));
+    std::remove(text_path.c_str());
+
+    // Refitting moves the points into memory, after which the file can be removed.
+    std::vector<ThreeDPoint> leaf_order;
+    mapped->get_points(leaf_order);
+    mapped->refit(leaf_order, 1.0);
+    ASSERT_FALSE(mapped->is_mapped());
+    std::remove(path.c_str());
+    std::vector<unsigned> expected;
+    std::vector<unsigned> found;
+    search_tree.radial_search(original[0], 2.0, expected);
+    mapped->radial_search(original[0], 2.0, found);
+    ASSERT_EQ(found, expected);
+}
+
+TEST(NNSearch, ExternalBuildMatchesInMemoryTree)
+{
+    const std::string point_path = "external_build_test.bin";
+    const std::string tree_path = "external_build_test.nnkd";
+    std::mt19937 gen(89);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::uniform_int_distribution<int> ties(0, 15);
+    ThreadPool pool(2);
+    for (bool integral : {false, true}) {
+        // Integer coordinates produce many points tied at every split.
+        std::vector<ThreeDPoint> points;
+        for (unsigned i = 1; i <= 20000; ++i) {
+            if (integral)
+                points.emplace_back(ThreeDPoint(i, ties(gen), ties(gen), ties(gen)));
+            else
+                points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+        }
+        ASSERT_TRUE(save_binary_points(point_path, points, false));
+        const std::vector<ThreeDPoint> original = points;
+        ThreeDTree search_tree(points, 1, 8);
+
+        // Nodes with more than 1024 points are partitioned on disk.
+        std::unique_ptr<ThreeDTree> external = ThreeDTree::build_mapped(point_path, tree_path, 1024, 2, 8);
+        ASSERT_NE(nullptr, external);
+        ASSERT_TRUE(external->is_mapped());
+        ASSERT_EQ(external->size(), search_tree.size());
+        ASSERT_NEAR(external->overlap(), search_tree.overlap(), 1e-9);
+        ASSERT_FALSE(std::ifstream(tree_path + ".bucket1").good());
+
+        for (std::size_t q = 0; q < original.size(); q += 97) {
+            const ThreeDPoint& p = original[q];
+            std::vector<unsigned> expected;
+            std::vector<unsigned> found;
+            search_tree.radial_search(p, 1.5, expected);
+            external->radial_search(p, 1.5, found);
+            std::sort(expected.begin(), expected.end());
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(found, expected);
+            ASSERT_EQ(external->radial_count(p, 1.5), expected.size());
+
+            if (!integral) {
+                expected.clear();
+                found.clear();
+                search_tree.knn_search(p, 8, expected);
+                external->knn_search(p, 8, found);
+                ASSERT_EQ(found, expected);
+            }
+        }
+        external.reset();
+    }
+
+    // A directory in the way of a grandchild's bucket fails the build partway, after the root was split.
+    auto exists = [](const std::string& path) {
+        struct stat info;
+        return (0 == stat(path.c_str(), &info));
+    };
+    ASSERT_EQ(0, mkdir((tree_path + ".bucket3").c_str(), 0755));
+    ASSERT_EQ(nullptr, ThreeDTree::build_mapped(point_path, tree_path, 1024, 2, 8));
+    for (int node = 1; node <= 6; ++node)
+        ASSERT_FALSE(exists(tree_path + ".bucket" + std::to_string(node))) << "bucket " << node;
+    ASSERT_FALSE(exists(tree_path));
+    std::remove(point_path.c_str());
+}
+
+TEST(NNSearch, MortonOrderedBatchMatchesBatch)
+{
+    // Queries in random order, so that running them in Morton order changes which ones share a chunk.
+    std::mt19937 gen(89);
+    std::uniform_real_distribution<double> dist(0.0, 20.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 6000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), std::round(dist(gen))));
+    const std::vector<ThreeDPoint> original = points;
+    ThreeDTree search_tree(points, 1, 16);
+
+    std::vector<ThreeDPoint> queries(original.begin(), original.begin() + 5000);
+    queries.emplace_back(ThreeDPoint(0, 100, 100, 100));
+    std::shuffle(queries.begin(), queries.end(), gen);
+    UniformGrid3D grid(original, 1.5);
+    ThreadPool pool(3);
+    NeighborLists expected;
+    NeighborLists tree_neighbors;
+    NeighborLists grid_neighbors;
+    search_tree.radial_search_batch(queries.data(), queries.size(), 1.5, pool, expected);
+    search_tree.radial_search_batch(queries.data(), queries.size(), 1.5, pool, tree_neighbors, true);
+    grid.radial_search_batch(queries.data(), queries.size(), 1.5, pool, grid_neighbors, true);
+    ASSERT_EQ(tree_neighbors.size(), queries.size());
+    ASSERT_EQ(grid_neighbors.size(), queries.size());
+    for (std::size_t q = 0; q < queries.size(); ++q) {
+        std::vector<unsigned> ids(expected.begin(q), expected.end(q));
+        std::vector<unsigned> tree_ids(tree_neighbors.begin(q), tree_neighbors.end(q));
+        std::vector<unsigned> grid_ids(grid_neighbors.begin(q), grid_neighbors.end(q));
+        std::sort(ids.begin(), ids.end());
+        std::sort(tree_ids.begin(), tree_ids.end());
+        std::sort(grid_ids.begin(), grid_ids.end());
+        ASSERT_EQ(tree_ids, ids);
+        ASSERT_EQ(grid_ids, ids);
+    }
+}
+
+TEST(NNSearch, ContainedSubtreesSkipCoincidentPoints)
+{
+    std::mt19937 gen(51);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 500; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    const ThreeDPoint ref = points[100];
+    points.emplace_back(ThreeDPoint(501, ref.x_, ref.y_, ref.z_));
+
+    ThreeDTree search_tree(points, 1, 4);
+
+    // The radius covers every box, so every subtree is reported in bulk.
+    std::vector<ThreeDPoint> neighbors;
+    search_tree.radial_search(ref, 10.0, neighbors);
+    ASSERT_EQ(neighbors.size(), 499u);
+    for (const ThreeDPoint& n : neighbors)
+        ASSERT_FALSE((n.x_ == ref.x_) && (n.y_ == ref.y_) && (n.z_ == ref.z_));
+}
+
+TEST(NNSearch, RefitMatchesBruteForce)
+{
+    std::mt19937 gen(41);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::uniform_real_distribution<double> step(-0.05, 0.05);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 2000; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+
+    ThreeDTree search_tree(points, 1, 8);
+    ASSERT_EQ(search_tree.overlap(), 0);
+
+    // Small steps keep the topology. The final step scrambles every point, which forces a rebuild.
+    for (int s = 0; s <= 10; ++s) {
+        for (ThreeDPoint& p : points) {
+            if (10 == s) {
+                p = ThreeDPoint(p.id_, dist(gen), dist(gen), dist(gen));
+            } else {
+                p.x_ += step(gen);
+                p.y_ += step(gen);
+                p.z_ += step(gen);
+            }
+        }
+        ASSERT_EQ(search_tree.refit(points, 0.1), (10 == s));
+        if (10 == s)
+            ASSERT_EQ(search_tree.overlap(), 0);
+        else
+            ASSERT_GT(search_tree.overlap(), 0);
+
+        check_radial_matches_brute_force(search_tree, points, 1.5, 13);
+        for (std::size_t q = 0; q < points.size(); q += 13) {
+            std::vector<ThreeDPoint> neighbors;
+            search_tree.knn_search(points[q], 5, neighbors);
+            std::vector<unsigned> nearest = brute_force_nearest_ids(points, points[q]);
+            ASSERT_EQ(neighbors.size(), 5u);
+            for (std::size_t i = 0; i < neighbors.size(); ++i)
+                ASSERT_EQ(neighbors[i].id_, nearest[i]);
+        }
+    }
+}
+
+TEST(NNSearch, DynamicTreeMatchesBruteForce)
+{
+    std::mt19937 gen(21);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::vector<ThreeDPoint> initial;
+    for (unsigned i = 1; i <= 2000; ++i)
+        initial.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    std::vector<ThreeDPoint> live = initial;
+    DynamicThreeDTree search_tree(initial, 8);
+
+    // Interleave inserts and erases, including erasing buffered points and reinserting erased IDs.
+    unsigned next_id = 2001;
+    for (unsigned step = 0; step < 6000; ++step) {
+        if (live.empty() || (gen() % 3)) {
+            unsigned id = ((gen() % 4) || (next_id < 2100)) ? next_id++ : 1 + (gen() % (next_id - 1));
+            ThreeDPoint p(id, dist(gen), dist(gen), dist(gen));
+            bool present = std::any_of(live.begin(), live.end(), [id](const ThreeDPoint& q) { return (q.id_ == id); });
+            ASSERT_EQ(search_tree.insert(p), !present);
+            if (!present)
+                live.push_back(p);
+        } else {
+            std::size_t victim = gen() % live.size();
+            ASSERT_TRUE(search_tree.erase(live[victim].id_));
+            ASSERT_FALSE(search_tree.erase(live[victim].id_));
+            live[victim] = live.back();
+            live.pop_back();
+        }
+
+        if (0 != (step % 500))
+            continue;
+        ASSERT_EQ(search_tree.size(), live.size());
+        check_radial_matches_brute_force(search_tree, live, 1.5, 37);
+        for (std::size_t q = 0; q < live.size(); q += 37) {
+            std::vector<ThreeDPoint> neighbors;
+            search_tree.knn_search(live[q], 5, neighbors);
+            std::vector<unsigned> nearest = brute_force_nearest_ids(live, live[q]);
+            ASSERT_EQ(neighbors.size(), std::min<std::size_t>(5, nearest.size()));
+            for (std::size_t i = 0; i < neighbors.size(); ++i)
+                ASSERT_EQ(neighbors[i].id_, nearest[i]);
+        }
+    }
+}
+
+TEST(NNSearch, VerletListsMatchBruteForce)
+{
+    std::mt19937 gen(31);
+    std::uniform_real_distribution<double> dist(0.0, 10.0);
+    std::uniform_real_distribution<double> step(-0.05, 0.05);
+    std::vector<ThreeDPoint> points;
+    for (unsigned i = 1; i <= 1500; ++i)
+        points.emplace_back(ThreeDPoint(i, dist(gen), dist(gen), dist(gen)));
+    // Coincident points are not neighbors now but may become neighbors once they move apart.
+    points[1] = ThreeDPoint(points[1].id_, points[0].x_, points[0].y_, points[0].z_);
+
+    ThreadPool pool(3);
+    VerletLists lists(1.0, 0.3);
+    for (int s = 0; s < 30; ++s) {
+        lists.update(points, pool);
+        const NeighborLists& neighbors = lists.neighbors();
+        ASSERT_EQ(neighbors.size(), points.size());
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            std::vector<unsigned> found(neighbors.begin(i), neighbors.end(i));
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(found, brute_force_radial_ids(points, points[i], 1.0));
+        }
+
+        for (ThreeDPoint& p : points) {
+            p.x_ += step(gen);
+            p.y_ += step(gen);
+            p.z_ += step(gen);
+        }
+    }
+    ASSERT_LT(lists.rebuild_count(), 30u);
+}
+
+/*!
+ * \brief Check radial, k-nearest neighbor, and self-join queries on a KdTree<T, K> against brute force.
+ */
+template <typename T, int K>
+void check_kd_tree_matches_brute_force(unsigned seed, std::size_t leaf_size)
+{
+    typedef KdTree<T, K> Tree;
+    typedef typename Tree::Point Point;
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> dist(0.0, 10.0);
+    std::vector<Point> points;
+    for (unsigned i = 1; i <= 2000; ++i) {
+        T location[K];
+        for (int axis = 0; axis < K; ++axis)
+            location[axis] = dist(gen);
+        points.push_back(Point(i, location));
+    }
+    const std::vector<Point> original = points;
+    const T rad = (K > 3) ? 5.0 : 1.5;
+
+    // Sum the terms in axis order, as the tree does, so float distances round identically.
+    auto distance_squared = [](const Point& a, const Point& b) {
+        T d = 0;
+        for (int axis = 0; axis < K; ++axis)
+            d += (a[axis] - b[axis]) * (a[axis] - b[axis]);
+        return d;
+    };
+
+    Tree search_tree(points, 1, leaf_size);
+    ASSERT_EQ(search_tree.size(), original.size());
+
+    std::vector<std::pair<unsigned, unsigned>> expected_pairs;
+    for (std::size_t q = 0; q < original.size(); ++q) {
+        const Point& p = original[q];
+        std::vector<Point> neighbors;
+        search_tree.radial_search(p, rad, neighbors);
+
+        std::vector<unsigned> found;
+        for (const Point& n : neighbors)
+            found.push_back(n.id_);
+        std::vector<unsigned> expected;
+        std::vector<T> nearest;
+        for (const Point& o : original) {
+            T d = distance_squared(p, o);
+            if ((d <= rad * rad) && (0 != d)) {
+                expected.push_back(o.id_);
+                if (p.id_ < o.id_)
+                    expected_pairs.emplace_back(p.id_, o.id_);
+            }
+            if (0 != d)
+                nearest.push_back(d);
+        }
+        std::sort(found.begin(), found.end());
+        std::sort(expected.begin(), expected.end());
+        ASSERT_EQ(found, expected);
+
+        if (0 == (q % 97)) {
+            const std::size_t k = 10;
+            std::sort(nearest.begin(), nearest.end());
+            neighbors.clear();
+            search_tree.knn_search(p, k, neighbors);
+            ASSERT_EQ(neighbors.size(), k);
+            for (std::size_t i = 0; i < k; ++i)
+                ASSERT_EQ(distance_squared(p, neighbors[i]), nearest[i]);
+        }
+    }
+
+    std::vector<std::pair<unsigned, unsigned>> pairs;
+    search_tree.radial_self_join(rad, false, pairs);
+    std::sort(pairs.begin(), pairs.end());
+    std::sort(expected_pairs.begin(), expected_pairs.end());
+    ASSERT_EQ(pairs, expected_pairs);
+}
+
+TEST(KdTree, FloatMatchesBruteForce)
+{
+    check_kd_tree_matches_brute_force<float, 3>(11, 1);
+    check_kd_tree_matches_brute_force<float, 3>(12, 32);
+}
+
+TEST(KdTree, TwoDimensionalMatchesBruteForce)
+{
+    check_kd_tree_matches_brute_force<double, 2>(13, 1);
+    check_kd_tree_matches_brute_force<double, 2>(14, 32);
+}
+
+TEST(KdTree, SixDimensionalMatchesBruteForce)
+{
+    check_kd_tree_matches_brute_force<double, 6>(15, 1);
+    check_kd_tree_matches_brute_force<double, 6>(16, 32);
+}
+
+TEST(KdTree, RangeBeginHandlesBillionsOfPoints)
+{
+    // Five billion points in buckets of one put the leaves on level 32, where k * n exceeds 64 bits.
+    const std::size_t npoints = 5000000000ULL;
+    const int leaf_depth = 32;
+    ASSERT_GT(npoints >> (leaf_depth - 1), 1u);
+    ASSERT_LE(npoints >> leaf_depth, 1u);
+    const std::size_t nleaves = std::size_t(1) << leaf_depth;
+    ASSERT_GT(npoints, std::numeric_limits<std::size_t>::max() / nleaves);
+
+    ASSERT_EQ(nnalgo::detail::range_begin(npoints, leaf_depth, 0), 0u);
+    ASSERT_EQ(nnalgo::detail::range_begin(npoints, leaf_depth, nleaves), npoints);
+    ASSERT_EQ(nnalgo::detail::range_begin(npoints, leaf_depth, nleaves - 1), npoints - 2);
+    std::mt19937_64 gen(89);
+    std::uniform_int_distribution<std::size_t> leaf(0, nleaves - 1);
+    for (int i = 0; i < 10000; ++i) {
+        // Every node's range splits exactly into its children's, and leaves hold one or two points.
+        const std::size_t k = leaf(gen);
+        for (int depth = 1; depth <= leaf_depth; ++depth) {
+            const std::size_t node = k >> (leaf_depth - depth);
+            ASSERT_EQ(nnalgo::detail::range_begin(npoints, depth, node),
+                    nnalgo::detail::range_begin(npoints, depth + 1, 2 * node));
+        }
+        const std::size_t size = nnalgo::detail::range_begin(npoints, leaf_depth, k + 1) -
+                nnalgo::detail::range_begin(npoints, leaf_depth, k);
+        ASSERT_GE(size, 1u);
+        ASSERT_LE(size, 2u);
+    }
+
+    // Halfway through the leaves is halfway through the points.
+    ASSERT_EQ(nnalgo::detail::range_begin(npoints, leaf_depth, nleaves / 2), npoints / 2);
+}
+
+TEST(PointIO, TextLoaderMatchesStrtod)
+{
+    const char* values[] = {"0", "-0.5", "1e3", "+2.25E-2", "3.", "1234567890.0987654321", "0.1",
+        "-123456789012345678901234567890", "4.9e-324", "1.7976931348623157e308", "7", "-8"};
+    const std::size_t nvalues = sizeof(values) / sizeof(values[0]);
+
+    const std::string path = "point_io_test.txt";
+    {
+        std::ofstream out(path);
+        out << nvalues / 3 << "\n";
+        for (std::size_t i = 0; i < nvalues; i += 3)
+            out << values[i] << " \t" << values[i+1] << "  " << values[i+2] << "\r\n";
+    }
+
+    ThreadPool pool(2);
+    std::vector<ThreeDPoint> points;
+    ASSERT_TRUE(load_text_points(path, pool, points));
+    ASSERT_EQ(points.size(), nvalues / 3);
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        ASSERT_EQ(points[i].id_, i + 1);
+        ASSERT_EQ(points[i].x_, std::strtod(values[3*i], nullptr));
+        ASSERT_EQ(points[i].y_, std::strtod(values[3*i+1], nullptr));
+        ASSERT_EQ(points[i].z_, std::strtod(values[3*i+2], nullptr));
+    }
+
+    {
+        std::ofstream out(path);
+        out << "3\n0 0 0\n1 1 x\n2 2 2\n";
+    }
+    ASSERT_FALSE(load_text_points(path, pool, points));
+    std::remove(path.c_str());
+}
+
+TEST(PointIO, BinaryRoundTrip)
+{
+    std::vector<ThreeDPoint> points;
+    points.emplace_back(ThreeDPoint(2, 0.1, -2.5, 3.0));
+    points.emplace_back(ThreeDPoint(1, 1e10, 0.0, -7.25));
+    points.emplace_back(ThreeDPoint(3, 1.0/3.0, 2.0, 4.0));
+
+    const std::string path = "point_io_test.bin";
+    ThreadPool pool(2);
+    for (bool single_precision : {false, true}) {
+        ASSERT_TRUE(save_binary_points(path, points, single_precision));
+        ASSERT_TRUE(is_binary_point_file(path));
+
+        std::vector<ThreeDPoint> loaded;
+        ASSERT_TRUE(load_binary_points(path, pool, loaded));
+        ASSERT_EQ(loaded.size(), points.size());
+        for (const ThreeDPoint& p : points) {
+            const ThreeDPoint& q = loaded[p.id_-1];
+            ASSERT_EQ(q.id_, p.id_);
+            if (single_precision) {
+                ASSERT_EQ(q.x_, static_cast<float>(p.x_));
+                ASSERT_EQ(q.y_, static_cast<float>(p.y_));
+                ASSERT_EQ(q.z_, static_cast<float>(p.z_));
+            } else {
+                ASSERT_EQ(q.x_, p.x_);
+                ASSERT_EQ(q.y_, p.y_);
+                ASSERT_EQ(q.z_, p.z_);
+            }
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(PointIO, BinaryRejectsMoreThan32BitIds)
+{
+    // A sparse file declaring 2^32 points is mapped without storing its 48 GB of zeros.
+    const std::string path = "point_io_ids_test.bin";
+    const std::string tree_path = "point_io_ids_test.nnkd";
+    const std::uint64_t count = std::uint64_t(1) << 32;
+    std::vector<ThreeDPoint> points(1, ThreeDPoint(1, 0.0, 0.0, 0.0));
+    ASSERT_TRUE(save_binary_points(path, points, true));
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offsetof(BinaryPointHeader, count_));
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+    if (0 != truncate(path.c_str(), sizeof(BinaryPointHeader) + (count * 3 * sizeof(float)))) {
+        std::remove(path.c_str());
+        GTEST_SKIP() << "Sparse files are not supported here.";
+    }
+
+    // Point IDs would wrap past 2^32 - 1, so both loaders refuse the file.
+    ThreadPool pool(1);
+    std::vector<ThreeDPoint> loaded;
+    ASSERT_FALSE(load_binary_points(path, pool, loaded));
+    ASSERT_EQ(nullptr, ThreeDTree::build_mapped(path, tree_path, 1024));
+    ASSERT_FALSE(std::ifstream(tree_path).good());
+    std::remove(path.c_str());
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();